@@ -0,0 +1,135 @@
+/*
+ * AllocCounter.cpp
+ *
+ */
+
+#include <atomic>
+#include <cerrno>
+
+#include "AllocCounter.h"
+
+static std::atomic<bool> counting(false);
+static std::atomic<unsigned long> count(0);
+static std::atomic<unsigned long long> bytes(0);
+static std::atomic<unsigned long> stageCounts[Stats::STAGES];
+
+#if defined(COUNT_ALLOCS) && defined(__GLIBC__)
+static inline void countAlloc(size_t size) {
+    if (counting.load(std::memory_order_relaxed)) {
+        count.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void* __libc_valloc(size_t size);
+void* __libc_pvalloc(size_t size);
+
+void* malloc(size_t size) {
+    countAlloc(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    countAlloc(n * size);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    countAlloc(size);
+    return __libc_realloc(ptr, size);
+}
+
+void* reallocarray(void* ptr, size_t n, size_t size) {
+    if (size != 0 && n > (size_t) -1 / size) {
+        errno = ENOMEM;
+        return 0;
+    }
+    return realloc(ptr, n * size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0) {
+        return EINVAL;
+    }
+    countAlloc(size);
+    void* p = __libc_memalign(alignment, size);
+    if (!p) {
+        return ENOMEM;
+    }
+    *ptr = p;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    countAlloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    countAlloc(size);
+    return __libc_memalign(alignment, size);
+}
+
+void* valloc(size_t size) {
+    countAlloc(size);
+    return __libc_valloc(size);
+}
+
+void* pvalloc(size_t size) {
+    countAlloc(size);
+    return __libc_pvalloc(size);
+}
+
+}
+#endif
+
+bool AllocCounter::available() {
+#if defined(COUNT_ALLOCS) && defined(__GLIBC__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Reset the counters and count from now on.
+ */
+void AllocCounter::start() {
+    count = 0;
+    bytes = 0;
+    for (int i = 0; i < Stats::STAGES; ++i) {
+        stageCounts[i] = 0;
+    }
+    counting = true;
+}
+
+void AllocCounter::stop() {
+    counting = false;
+}
+
+unsigned long AllocCounter::getCount() {
+    return count;
+}
+
+unsigned long long AllocCounter::getBytes() {
+    return bytes;
+}
+
+/**
+ * Add the allocations of one run of a stage.
+ */
+void AllocCounter::countStage(Stats::Stage stage, unsigned long allocs) {
+    if (counting.load(std::memory_order_relaxed)) {
+        stageCounts[stage].fetch_add(allocs, std::memory_order_relaxed);
+    }
+}
+
+unsigned long AllocCounter::getStageCount(Stats::Stage stage) {
+    return stageCounts[stage];
+}
@@ -0,0 +1,32 @@
+/*
+ * AllocCounter.h
+ *
+ */
+
+#ifndef ALLOCCOUNTER_H_
+#define ALLOCCOUNTER_H_
+
+#include <cstddef>
+
+#include "Stats.h"
+
+/**
+ * Counts the heap allocations of the whole process while enabled, in total
+ * and per processing stage (see StageTimer).
+ * Only built with COUNT_ALLOCS=true: the allocation functions of glibc are
+ * then replaced by counting wrappers, which also covers operator new and the
+ * allocations of OpenCV. Used by the allocation check (-B alloc).
+ */
+class AllocCounter {
+public:
+    static bool available();
+    static void start();
+    static void stop();
+    static unsigned long getCount();
+    static unsigned long long getBytes();
+
+    static void countStage(Stats::Stage stage, unsigned long allocs);
+    static unsigned long getStageCount(Stats::Stage stage);
+};
+
+#endif /* ALLOCCOUNTER_H_ */
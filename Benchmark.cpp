@@ -0,0 +1,714 @@
+/*
+ * Benchmark.cpp
+ *
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <log4cpp/Category.hh>
+#include <log4cpp/Priority.hh>
+
+#include "Benchmark.h"
+#include "ImageProcessor.h"
+#include "Config.h"
+#include "Stats.h"
+#include "KNearestOcr.h"
+#include "LinearOcr.h"
+#include "HttpClient.h"
+#include "HttpTestServer.h"
+#include "KnnIndex.h"
+#include "AllocCounter.h"
+
+Benchmark::Benchmark(ImageInput* pImageInput) :
+        _pImageInput(pImageInput), _failed(0) {
+}
+
+/**
+ * Run the benchmark of the given name. Returns false for an unknown name.
+ */
+bool Benchmark::run(const std::string & name) {
+    if (name == "skew") {
+        if (loadImages()) {
+            skew();
+        }
+        return true;
+    } else if (name == "alloc") {
+        if (!_pImageInput || loadImages()) {
+            alloc();
+        }
+        return true;
+    } else if (name == "spool") {
+        spool();
+        return true;
+    } else if (name == "http") {
+        http();
+        return true;
+    } else if (name == "ocr") {
+        ocr();
+        return true;
+    } else if (name == "load") {
+        load();
+        return true;
+    } else if (name == "knn") {
+        if (!_pImageInput || loadImages()) {
+            knn();
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Number of failed checks of the last run.
+ */
+int Benchmark::getFailed() const {
+    return _failed;
+}
+
+/**
+ * Read all images of the input into memory, so that reading is not measured.
+ */
+bool Benchmark::loadImages() {
+    if (!_pImageInput) {
+        std::cerr << "*** The benchmark needs an image input (e.g. -i)!\n";
+        return false;
+    }
+    while (_pImageInput->nextImage()) {
+        if (!_pImageInput->isSkipped()) {
+            _images.push_back(_pImageInput->getImage().clone());
+        }
+    }
+    if (_images.empty()) {
+        std::cerr << "*** No images for the benchmark!\n";
+        return false;
+    }
+    return true;
+}
+
+void Benchmark::report(const std::string & line) {
+    std::cout << line << std::endl;
+    log4cpp::Category::getRoot().info(line);
+}
+
+/**
+ * Compare the skew engines. Each image is also turned by known angles around
+ * the center of the counter window; the error is the difference between the
+ * change of the detected skew and the applied angle.
+ */
+void Benchmark::skew() {
+    static const char* engines[] = { "hough", "profile" };
+    static const float angles[] = { -6.f, -3.f, -1.f, 1.f, 3.f, 6.f };
+    const int angleCount = sizeof(angles) / sizeof(angles[0]);
+
+    cv::Rect window(0, 0, _images[0].cols, _images[0].rows);
+    if (config.getRoiWidth() > 0 && config.getRoiHeight() > 0) {
+        window = cv::Rect(config.getRoiX(), config.getRoiY(), config.getRoiWidth(), config.getRoiHeight()) & window;
+    }
+    cv::Point2f center(window.x + window.width / 2.f, window.y + window.height / 2.f);
+
+    char line[200];
+    snprintf(line, sizeof(line), "skew benchmark: %d images, %d angles", (int) _images.size(), angleCount);
+    report(line);
+    snprintf(line, sizeof(line), "%-8s %8s %8s %10s %10s %10s", "engine", "runs", "failed", "mean [ms]",
+            "err [deg]", "max [deg]");
+    report(line);
+
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); ++e) {
+        HeadlessImageProcessor proc;
+        int runs = 0;
+        int failed = 0;
+        int measured = 0;
+        long long time = 0;
+        double errorSum = 0.;
+        double errorMax = 0.;
+        cv::Mat turned;
+        for (size_t i = 0; i < _images.size(); ++i) {
+            float base = 0.f;
+            for (int a = -1; a < angleCount; ++a) {
+                float angle = a < 0 ? 0.f : angles[a];
+                if (a < 0) {
+                    proc.setInput(_images[i]);
+                } else {
+                    cv::warpAffine(_images[i], turned, cv::getRotationMatrix2D(center, angle, 1), _images[i].size(),
+                            cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+                    proc.setInput(turned);
+                }
+                proc.detectEdges();
+                float skew;
+                long long start = Stats::now();
+                bool found = proc.measureSkew(engines[e], skew);
+                time += Stats::now() - start;
+                ++runs;
+                if (!found) {
+                    ++failed;
+                    if (a < 0) {
+                        // no reference for the turned images
+                        break;
+                    }
+                } else if (a < 0) {
+                    base = skew;
+                } else {
+                    // turning the image by angle needs a correction of -angle
+                    double error = std::fabs(skew - base + angle);
+                    errorSum += error;
+                    errorMax = std::max(errorMax, error);
+                    ++measured;
+                }
+            }
+        }
+        snprintf(line, sizeof(line), "%-8s %8d %8d %10.2f %10.2f %10.2f", engines[e], runs, failed,
+                runs ? time / 1000. / runs : 0., measured ? errorSum / measured : 0., errorMax);
+        report(line);
+    }
+}
+
+/**
+ * Heap allocations a processing stage may do per frame once the buffers are
+ * warmed up. The stages on reused buffers must not allocate at all, the
+ * others are bounded by what OpenCV 2.4 allocates internally per call.
+ */
+static const struct {
+    Stats::Stage stage;
+    unsigned long bound;
+    const char* reason;
+} allocBounds[] = {
+    { Stats::BLUR, 32, "GaussianBlur builds a FilterEngine with kernels and row buffers" },
+    { Stats::GRAY, 0, 0 },
+    { Stats::EDGES, 48, "Canny: dx/dy, two Sobel FilterEngines, magnitude rows, edge stack" },
+    { Stats::SKEW, 0, 0 },
+    { Stats::ROTATE, 2, "warpAffine: row offset AutoBuffer per call above 132 pixels width" },
+    { Stats::DIGITS, 12, "findContours: CvMemStorage, its blocks and the scanner" },
+};
+
+/**
+ * Synthetic counter for the allocation check without an image input:
+ * meterValueLength white digits between two long horizontal lines on black,
+ * sized in the middle of the digit height range. Assumes rotationDegrees 0
+ * and no roi, use a recorded frame (-i) otherwise.
+ */
+static cv::Mat counterFixture() {
+    const int font = cv::FONT_HERSHEY_SIMPLEX;
+    const int height = (config.getDigitMinHeight() + config.getDigitMaxHeight()) / 2;
+    int baseline;
+    double scale = height / (double) cv::getTextSize("0", font, 1., 1, &baseline).height;
+    int thickness = std::max(2, height / 8);
+    int digits = config.getMeterValueLength();
+    cv::Mat img(height * 4, height * (digits + 2), CV_8UC3, cv::Scalar::all(0));
+    cv::line(img, cv::Point(height / 2, height), cv::Point(img.cols - height / 2, height), cv::Scalar::all(255), 2);
+    cv::line(img, cv::Point(height / 2, 3 * height), cv::Point(img.cols - height / 2, 3 * height),
+            cv::Scalar::all(255), 2);
+    for (int d = 0; d < digits; ++d) {
+        char text[2] = { (char) ('2' + d % 8), 0 };
+        cv::putText(img, text, cv::Point(height * (d + 1), height * 5 / 2), font, scale, cv::Scalar::all(255),
+                thickness);
+    }
+    return img;
+}
+
+/**
+ * Check that ImageProcessor::process() keeps within the allocation bounds of
+ * each stage. One fixture frame, the first image of the input or a synthetic
+ * counter, is processed again and again: after the warm-up the buffers and
+ * the skew and digit tracking are in their steady state. Counted at log level
+ * WARN and with OpenCV single threaded, the allocations of the log output and
+ * of the parallel framework are reported separately. Needs COUNT_ALLOCS.
+ */
+void Benchmark::alloc() {
+    if (!AllocCounter::available()) {
+        report("alloc check: needs a build with COUNT_ALLOCS=true (glibc)");
+        ++_failed;
+        return;
+    }
+    static const int WARMUP = 3;
+    const int frames = std::min(20, config.getSkewRecheckInterval() - WARMUP);
+    if (frames < 1) {
+        report("alloc check: needs skewRecheckInterval > 4, the skew search would run in the measured frames");
+        ++_failed;
+        return;
+    }
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    const log4cpp::Priority::Value priority = rlog.getPriority();
+    const int numThreads = cv::getNumThreads();
+    cv::setNumThreads(0);
+
+    cv::Mat fixture = _images.empty() ? counterFixture() : _images[0];
+    HeadlessImageProcessor proc;
+    for (int i = 0; i < WARMUP; ++i) {
+        proc.setInput(fixture);
+        proc.process();
+    }
+
+    char line[200];
+    snprintf(line, sizeof(line), "alloc check: %d frames of %dx%d after %d warm-up frames", frames, fixture.cols,
+            fixture.rows, WARMUP);
+    report(line);
+
+    const int boundCount = sizeof(allocBounds) / sizeof(allocBounds[0]);
+    unsigned long maxStage[boundCount] = { 0 };
+    unsigned long maxOutside = 0;
+    rlog.setPriority(log4cpp::Priority::WARN);
+    for (int f = 0; f < frames; ++f) {
+        proc.setInput(fixture);
+        AllocCounter::start();
+        proc.process();
+        AllocCounter::stop();
+        unsigned long inStages = 0;
+        for (int b = 0; b < boundCount; ++b) {
+            unsigned long count = AllocCounter::getStageCount(allocBounds[b].stage);
+            maxStage[b] = std::max(maxStage[b], count);
+            inStages += count;
+        }
+        maxOutside = std::max(maxOutside, AllocCounter::getCount() - inStages);
+    }
+
+    // with the log output of the configured level, for information
+    rlog.setPriority(priority);
+    unsigned long logged = 0;
+    for (int f = 0; f < frames; ++f) {
+        proc.setInput(fixture);
+        AllocCounter::start();
+        proc.process();
+        AllocCounter::stop();
+        logged += AllocCounter::getCount();
+    }
+    cv::setNumThreads(numThreads);
+
+    int failed = 0;
+    for (int b = 0; b < boundCount; ++b) {
+        snprintf(line, sizeof(line), "%-6s %3lu allocs/frame, bound %lu%s%s", Stats::stageName(allocBounds[b].stage),
+                maxStage[b], allocBounds[b].bound, allocBounds[b].reason ? ": " : "",
+                allocBounds[b].reason ? allocBounds[b].reason : "");
+        check(line, maxStage[b] <= allocBounds[b].bound, failed);
+    }
+    snprintf(line, sizeof(line), "%-6s %3lu allocs/frame outside the stages", "other", maxOutside);
+    check(line, maxOutside == 0, failed);
+    snprintf(line, sizeof(line), "alloc check: %d checks failed, %.1f allocs/frame with log level %s", failed,
+            (double) logged / frames, log4cpp::Priority::getPriorityName(priority).c_str());
+    report(line);
+    _failed += failed;
+}
+
+/**
+ * Compare CvKNearest with the SIMD kNN engine on the digits of the input images,
+ * or on the training samples without an image input. Both engines must find
+ * the same two neighbours and distances.
+ */
+void Benchmark::knn() {
+    knnTies();
+    KNearestOcr ocr;
+    if (!ocr.loadTrainingData()) {
+        std::cerr << "*** Cannot load training data " << config.getTrainingDataFilename() << "!\n";
+        return;
+    }
+    ocr.loadSamples();
+    std::vector<cv::Mat> queries;
+    HeadlessImageProcessor proc;
+    for (size_t i = 0; i < _images.size(); ++i) {
+        proc.setInput(_images[i]);
+        proc.process();
+        const std::vector<cv::Mat> & digits = proc.getOutput();
+        for (size_t d = 0; d < digits.size(); ++d) {
+            queries.push_back(ocr.prepareSample(digits[d]));
+        }
+    }
+    if (queries.empty()) {
+        for (int i = 0; i < ocr._samples.rows; ++i) {
+            queries.push_back(ocr._samples.row(i));
+        }
+    }
+
+    char line[200];
+    KnnIndex index;
+    if (!index.build(ocr._samples, ocr._responses)) {
+        report("knn benchmark: training data does not fit into 8 bit");
+        return;
+    }
+    CvKNearest model(ocr._samples, ocr._responses, cv::Mat(), false, 2);
+    snprintf(line, sizeof(line), "knn benchmark: %d samples, %d queries, %s kernel", index.size(),
+            (int) queries.size(), KnnIndex::kernelName());
+    report(line);
+
+    std::vector<float> cvResponses(2 * queries.size());
+    std::vector<float> cvDists(2 * queries.size());
+    cv::Mat results, neighborResponses, dists;
+    long long start = Stats::now();
+    for (size_t q = 0; q < queries.size(); ++q) {
+        model.find_nearest(queries[q], 2, results, neighborResponses, dists);
+        for (int k = 0; k < 2; ++k) {
+            cvResponses[2 * q + k] = neighborResponses.at<float>(0, k);
+            cvDists[2 * q + k] = dists.at<float>(0, k);
+        }
+    }
+    long long cvTime = Stats::now() - start;
+
+    std::vector<KnnIndex::Neighbors> found(queries.size());
+    start = Stats::now();
+    for (size_t q = 0; q < queries.size(); ++q) {
+        found[q] = index.find(queries[q]);
+    }
+    long long simdTime = Stats::now() - start;
+
+    // batches of the size of a meter reading, as KNearestOcr::recognize() uses them
+    static const int BATCH = 8;
+    cv::Mat all;
+    for (size_t q = 0; q < queries.size(); ++q) {
+        all.push_back(queries[q]);
+    }
+    std::vector<KnnIndex::Neighbors> batchFound;
+    int batchMismatches = 0;
+    start = Stats::now();
+    for (int q = 0; q < all.rows; q += BATCH) {
+        index.find(all.rowRange(q, std::min(q + BATCH, all.rows)), batchFound);
+        for (size_t b = 0; b < batchFound.size(); ++b) {
+            const KnnIndex::Neighbors & n = found[q + b];
+            if (batchFound[b].count != n.count || (n.count > 0 && (batchFound[b].dists[0] != n.dists[0]
+                    || batchFound[b].responses[0] != n.responses[0]))) {
+                ++batchMismatches;
+            }
+        }
+    }
+    long long batchTime = Stats::now() - start;
+
+    int mismatches = 0;
+    for (size_t q = 0; q < queries.size(); ++q) {
+        for (int k = 0; k < 2; ++k) {
+            if (found[q].count <= k || found[q].responses[k] != cvResponses[2 * q + k]
+                    || found[q].dists[k] != cvDists[2 * q + k]) {
+                ++mismatches;
+                break;
+            }
+        }
+    }
+
+    snprintf(line, sizeof(line), "%-8s %10s %10s", "engine", "total [ms]", "query [us]");
+    report(line);
+    snprintf(line, sizeof(line), "%-8s %10.2f %10.2f", "opencv", cvTime / 1000., (double) cvTime / queries.size());
+    report(line);
+    snprintf(line, sizeof(line), "%-8s %10.2f %10.2f", "simd", simdTime / 1000., (double) simdTime / queries.size());
+    report(line);
+    snprintf(line, sizeof(line), "%-8s %10.2f %10.2f", "simd x8", batchTime / 1000.,
+            (double) batchTime / queries.size());
+    report(line);
+    snprintf(line, sizeof(line), "neighbours differing: %d of %d, batched: %d", mismatches,
+            (int) queries.size(), batchMismatches);
+    report(line);
+    if (mismatches > 0 || batchMismatches > 0) {
+        ++_failed;
+    }
+}
+
+/**
+ * Duplicate and equidistant samples: KnnIndex must find the same neighbours
+ * and distances as CvKNearest, and of equal distances the sample added first.
+ */
+void Benchmark::knnTies() {
+    static const float sampleData[][4] = {
+        { 10, 10, 10, 10 },
+        { 10, 10, 10, 10 },
+        { 12, 10, 10, 10 },
+        { 8, 10, 10, 10 },
+        { 10, 12, 10, 10 },
+    };
+    static const float queryData[][4] = {
+        { 10, 10, 10, 10 },
+        { 11, 10, 10, 10 },
+        { 12, 12, 10, 10 },
+        { 8, 12, 10, 10 },
+        { 200, 10, 10, 10 },
+    };
+    // responses of the two nearest samples, the earlier one of equal distances
+    static const float expected[][2] = {
+        { 1, 2 },
+        { 1, 2 },
+        { 3, 5 },
+        { 4, 5 },
+        { 3, 1 },
+    };
+    const int sampleCount = sizeof(sampleData) / sizeof(sampleData[0]);
+    const int queryCount = sizeof(queryData) / sizeof(queryData[0]);
+    cv::Mat samples(sampleCount, 4, CV_32F, (void*) sampleData);
+    cv::Mat responses(sampleCount, 1, CV_32F);
+    for (int i = 0; i < sampleCount; ++i) {
+        responses.at<float>(i, 0) = (float) (i + 1);
+    }
+
+    KnnIndex index;
+    index.build(samples, responses);
+    CvKNearest model(samples, responses, cv::Mat(), false, 2);
+    int sameAsOpencv = 0;
+    int firstWins = 0;
+    cv::Mat results, neighborResponses, dists;
+    for (int q = 0; q < queryCount; ++q) {
+        cv::Mat query(1, 4, CV_32F, (void*) queryData[q]);
+        KnnIndex::Neighbors n = index.find(query);
+        model.find_nearest(query, 2, results, neighborResponses, dists);
+        bool same = n.count == 2;
+        bool first = n.count == 2;
+        for (int k = 0; k < n.count; ++k) {
+            same = same && n.responses[k] == neighborResponses.at<float>(0, k) && n.dists[k] == dists.at<float>(0, k);
+            first = first && n.responses[k] == expected[q][k];
+        }
+        sameAsOpencv += same;
+        firstWins += first;
+    }
+    int failed = 0;
+    char name[100];
+    snprintf(name, sizeof(name), "ties: %d of %d queries with the neighbours of CvKNearest", sameAsOpencv, queryCount);
+    check(name, sameAsOpencv == queryCount, failed);
+    snprintf(name, sizeof(name), "ties: %d of %d queries with the earlier samples of equal distances", firstWins,
+            queryCount);
+    check(name, firstWins == queryCount, failed);
+    _failed += failed;
+}
+
+/**
+ * Startup time of the OCR with the YAML and the binary training data format:
+ * loading, initializing the model of the configured kNN engine and the first
+ * recognition, which touches the whole model.
+ */
+void Benchmark::load() {
+    static const int RUNS = 10;
+    KNearestOcr ocr;
+    if (!ocr.loadTrainingData()) {
+        std::cerr << "*** Cannot load training data " << config.getTrainingDataFilename() << "!\n";
+        return;
+    }
+    ocr.loadSamples();
+    if (ocr._samples.rows == 0) {
+        std::cerr << "*** No training data!\n";
+        return;
+    }
+    cv::Mat query = ocr._samples.row(0).clone();
+    const std::string files[] = { config.getTrainingDataFilename() + ".bench.yml",
+            config.getTrainingDataFilename() + ".bench.bin" };
+    const char* formats[] = { "yaml", "binary" };
+    if (!ocr.saveTrainingData(files[0], false) || !ocr.saveTrainingData(files[1], true)) {
+        std::cerr << "*** Cannot write the training data next to " << config.getTrainingDataFilename() << "!\n";
+        std::remove(files[0].c_str());
+        std::remove(files[1].c_str());
+        return;
+    }
+
+    char line[200];
+    snprintf(line, sizeof(line), "load benchmark: %d samples, %s kNN engine, %d runs", ocr._samples.rows,
+            config.getKnnEngine().c_str(), RUNS);
+    report(line);
+    snprintf(line, sizeof(line), "%-8s %10s %10s %10s", "format", "size [kB]", "mean [ms]", "max [ms]");
+    report(line);
+    for (int f = 0; f < 2; ++f) {
+        struct stat st;
+        long long size = stat(files[f].c_str(), &st) == 0 ? (long long) st.st_size : 0;
+        long long time = 0;
+        long long maxTime = 0;
+        for (int r = 0; r < RUNS; ++r) {
+            long long start = Stats::now();
+            KNearestOcr loaded;
+            loaded.loadTrainingData(files[f]);
+            loaded.recognizeSample(query);
+            long long elapsed = Stats::now() - start;
+            time += elapsed;
+            maxTime = std::max(maxTime, elapsed);
+        }
+        snprintf(line, sizeof(line), "%-8s %10.1f %10.2f %10.2f", formats[f], size / 1024., time / 1000. / RUNS,
+                maxTime / 1000.);
+        report(line);
+        std::remove(files[f].c_str());
+    }
+}
+
+/**
+ * Compare the OCR engines. Every 5th training sample is held out and
+ * recognized one by one by the engines trained on the other samples.
+ */
+void Benchmark::ocr() {
+    KNearestOcr data;
+    if (!data.loadTrainingData()) {
+        std::cerr << "*** Cannot load training data " << config.getTrainingDataFilename() << "!\n";
+        return;
+    }
+    data.loadSamples();
+    cv::Mat trainSamples, trainResponses, testSamples, testResponses;
+    for (int i = 0; i < data._samples.rows; ++i) {
+        if (i % 5 == 4) {
+            testSamples.push_back(data._samples.row(i));
+            testResponses.push_back(data._responses.row(i));
+        } else {
+            trainSamples.push_back(data._samples.row(i));
+            trainResponses.push_back(data._responses.row(i));
+        }
+    }
+    if (testSamples.empty()) {
+        std::cerr << "*** Not enough training data!\n";
+        return;
+    }
+
+    KNearestOcr knn;
+    LinearOcr linear;
+    Ocr* engines[] = { &knn, &linear };
+    const char* names[] = { "knn", "linear" };
+
+    char line[200];
+    snprintf(line, sizeof(line), "ocr benchmark: %d training samples, %d held out", trainSamples.rows,
+            testSamples.rows);
+    report(line);
+    snprintf(line, sizeof(line), "%-8s %10s %8s %8s %8s %10s %10s", "engine", "train [ms]", "correct", "rejected",
+            "wrong", "accuracy", "digit [us]");
+    report(line);
+    for (int e = 0; e < 2; ++e) {
+        long long start = Stats::now();
+        engines[e]->setTrainingData(trainSamples, trainResponses);
+        long long trainTime = Stats::now() - start;
+        int correct = 0;
+        int rejected = 0;
+        int wrong = 0;
+        long long time = 0;
+        for (int i = 0; i < testSamples.rows; ++i) {
+            start = Stats::now();
+            char c = engines[e]->recognizeSample(testSamples.row(i));
+            time += Stats::now() - start;
+            if (c == '?') {
+                ++rejected;
+            } else if (c - '0' == (int) testResponses.at<float>(i, 0)) {
+                ++correct;
+            } else {
+                ++wrong;
+            }
+        }
+        snprintf(line, sizeof(line), "%-8s %10.2f %8d %8d %8d %9.1f%% %10.2f", names[e], trainTime / 1000., correct,
+                rejected, wrong, 100. * correct / testSamples.rows, (double) time / testSamples.rows);
+        report(line);
+    }
+}
+
+void Benchmark::check(const char* name, bool passed, int & failed) {
+    char line[200];
+    snprintf(line, sizeof(line), "%-4s %s", passed ? "ok" : "FAIL", name);
+    report(line);
+    if (!passed) {
+        ++failed;
+    }
+}
+
+/**
+ * Check the disposal of processed files by the spool directory watch (-I)
+ * with spoolAction move in a temporary directory: a relative spoolDoneDir is
+ * created in the spool directory and the file is moved there, a spoolDoneDir
+ * that is not a directory stops the input.
+ */
+void Benchmark::spool() {
+    char tmpl[] = "/tmp/ocmeter-spool-XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        report("spool: cannot create a temporary directory");
+        ++_failed;
+        return;
+    }
+    const std::string dir = tmpl;
+    const std::string name = "20260101-120000.jpg";
+    const std::string action = config.getSpoolAction();
+    const std::string doneDir = config.getSpoolDoneDir();
+    cv::imwrite(dir + "/" + name, cv::Mat(8, 8, CV_8UC3, cv::Scalar::all(128)));
+
+    int failed = 0;
+    struct stat st;
+    config.setSpool("move", "done");
+    {
+        DirectoryWatchInput input(Directory(dir.c_str(), ".jpg"));
+        check("file in the spool directory read", input.nextImage() && !input.getImage().empty(), failed);
+        // the file is moved when the next one is requested or the input is closed
+    }
+    check("relative spoolDoneDir created in the spool directory",
+            stat((dir + "/done").c_str(), &st) == 0 && S_ISDIR(st.st_mode), failed);
+    check("processed file moved to spoolDoneDir", stat((dir + "/done/" + name).c_str(), &st) == 0
+            && stat((dir + "/" + name).c_str(), &st) != 0, failed);
+
+    config.setSpool("move", dir + "/done/" + name);
+    {
+        DirectoryWatchInput input(Directory(dir.c_str(), ".jpg"));
+        check("spoolDoneDir that is not a directory stops the input", !input.nextImage(), failed);
+    }
+    config.setSpool(action, doneDir);
+
+    unlink((dir + "/done/" + name).c_str());
+    unlink((dir + "/" + name).c_str());
+    rmdir((dir + "/done").c_str());
+    rmdir(dir.c_str());
+
+    char line[200];
+    snprintf(line, sizeof(line), "spool: %d checks failed", failed);
+    report(line);
+    _failed += failed;
+}
+
+/**
+ * Check the HTTP client against a local stand-in server: keep-alive,
+ * conditional requests, chunked bodies, the body size limit and the timeout.
+ * Each client is closed before the next one connects, the server serves
+ * one connection at a time.
+ */
+void Benchmark::http() {
+    HttpTestServer server;
+    if (!server.start()) {
+        report("http: cannot start the local test server");
+        return;
+    }
+    char base[64];
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d", server.getPort());
+    report(std::string("http: test server at ") + base);
+    int failed = 0;
+    {
+        HttpClient client(std::string(base) + "/image");
+        bool first = client.get(2000) && client.getStatus() == 200 && client.getBody().size() == 10;
+        check("200 with body of Content-Length", first, failed);
+        bool second = client.get(2000) && client.isNotModified();
+        check("304 Not Modified for the ETag of the first response",
+                second && server.getLastRequest().find("If-None-Match: \"v1\"") != std::string::npos, failed);
+        check("keep-alive: both requests on one connection", first && second && server.getConnections() == 1,
+                failed);
+    }
+    {
+        HttpClient client(std::string(base) + "/chunked");
+        bool done = client.get(2000) && client.getStatus() == 200;
+        const std::vector<unsigned char> & body = client.getBody();
+        check("chunked body", done && std::string(body.begin(), body.end()) == "hello chunked world", failed);
+    }
+    {
+        HttpClient client(std::string(base) + "/large");
+        client.setMaxBodySize(1024);
+        long long start = HttpClient::now();
+        bool done = client.get(2000);
+        check("Content-Length above the body limit fails at once", !done
+                && client.getError().find("too large") != std::string::npos && HttpClient::now() - start < 1000,
+                failed);
+    }
+    {
+        HttpClient client(std::string(base) + "/largechunked");
+        client.setMaxBodySize(1024);
+        long long start = HttpClient::now();
+        bool done = client.get(2000);
+        check("chunk above the body limit fails at once", !done
+                && client.getError().find("too large") != std::string::npos && HttpClient::now() - start < 1000,
+                failed);
+    }
+    {
+        HttpClient client(std::string(base) + "/slow");
+        long long start = HttpClient::now();
+        bool done = client.get(300);
+        long long elapsed = HttpClient::now() - start;
+        check("timeout after 300 ms without answer",
+                !done && client.getState() == HttpClient::FAILED && elapsed >= 290 && elapsed < 2000, failed);
+    }
+    server.stop();
+    char line[200];
+    snprintf(line, sizeof(line), "http: %d checks failed", failed);
+    report(line);
+    _failed += failed;
+}
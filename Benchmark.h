@@ -0,0 +1,45 @@
+/*
+ * Benchmark.h
+ *
+ */
+
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "ImageInput.h"
+
+/**
+ * Benchmarks of the processing steps on recorded images, and checks.
+ * The results are written to stdout and to the log.
+ */
+class Benchmark {
+public:
+    Benchmark(ImageInput* pImageInput);
+
+    bool run(const std::string & name);
+    int getFailed() const;
+
+private:
+    bool loadImages();
+    void report(const std::string & line);
+    void skew();
+    void alloc();
+    void knn();
+    void knnTies();
+    void load();
+    void ocr();
+    void http();
+    void spool();
+    void check(const char* name, bool passed, int & failed);
+
+    ImageInput* _pImageInput;
+    std::vector<cv::Mat> _images;
+    int _failed;
+};
+
+#endif /* BENCHMARK_H_ */
@@ -5,11 +5,23 @@
 
 #include <opencv2/highgui/highgui.hpp>
 #include <regex>
+#include <iostream>
+#include <set>
 
 #include "Config.h"
 
 Config config;
 
+/**
+ * Read a value that may be missing in older config files: keep the default then.
+ */
+template<typename T>
+static void readOptional(const cv::FileNode & node, T & value) {
+    if (!node.empty()) {
+        node >> value;
+    }
+}
+
 Config::Config() :
     _configFilename("config.yml"),
     _trainingDataFilename("trainctr.yml"),
@@ -27,13 +39,78 @@ Config::Config() :
     _digitYAlignment(10),
     _cannyThreshold1(100),
     _cannyThreshold2(200),
-    _whiteThreshold(90) {
+    _whiteThreshold(90),
+    _httpTimeout(10000),
+    _httpMaxBodySize(16 * 1024 * 1024),
+    _captureThread(0),
+    _spoolAction("keep"),
+    _spoolDoneDir("done"),
+    _roiX(0),
+    _roiY(0),
+    _roiWidth(0),
+    _roiHeight(0),
+    _redSuppression(0),
+    _skewRecheckInterval(50),
+    _statsInterval(3600),
+    _statsFilename(""),
+    _frameDiffThreshold(0.f),
+    _digitChangeThreshold(0.f),
+    _skewEngine("hough"),
+    _knnEngine("opencv"),
+    _dedupMaxDist(0.f),
+    _ocrEngine("knn"),
+    _ocrMinMargin(0.3f) {
 }
 
-void Config::saveConfig(std::string name = "") {
-    if name != ""
+void Config::saveConfig(std::string name) {
+    if (name != "")
         _configFilename = name;
     cv::FileStorage fs(_configFilename, cv::FileStorage::WRITE);
+    writeValues(fs);
+    if (!_meters.empty()) {
+        fs << "meters" << "[";
+        for (size_t i = 0; i < _meters.size(); ++i) {
+            fs << "{" << "name" << _meters[i]._name;
+            _meters[i].writeValues(fs);
+            fs << "}";
+        }
+        fs << "]";
+    }
+    fs.release();
+}
+
+void Config::loadConfig(std::string name) {
+    if (name != "")
+        _configFilename = name;
+    cv::FileStorage fs(_configFilename, cv::FileStorage::READ);
+    if (fs.isOpened()) {
+        readValues(fs.root());
+        // meters inherit all values and may override any of them,
+        // except the data file which defaults to <meterDataFilename>.<name>
+        _meters.clear();
+        std::set<std::string> dataFiles;
+        cv::FileNode meters = fs["meters"];
+        for (cv::FileNodeIterator it = meters.begin(); it != meters.end(); ++it) {
+            Config meter(*this);
+            meter._meters.clear();
+            meter._name = "meter" + std::to_string(_meters.size() + 1);
+            readOptional((*it)["name"], meter._name);
+            meter._meterDataFilename = _meterDataFilename + "." + meter._name;
+            meter.readValues(*it);
+            if (!dataFiles.insert(meter._meterDataFilename).second) {
+                std::cout << "Warning: meter " << meter._name << " shares meterDataFilename "
+                        << meter._meterDataFilename << " with another meter" << std::endl;
+            }
+            _meters.push_back(meter);
+        }
+        fs.release();
+    } else {
+        // no config file - create an initial one with default values
+        saveConfig();
+    }
+}
+
+void Config::writeValues(cv::FileStorage & fs) const {
     fs << "trainingDataFilename" << _trainingDataFilename;
     fs << "meterDataFilename" << _meterDataFilename;
     fs << "logFilename" << _logFilename;
@@ -50,38 +127,93 @@ void Config::saveConfig(std::string name = "") {
     fs << "digitYAlignment" << _digitYAlignment;
     fs << "ocrMaxDist" << _ocrMaxDist;
     fs << "whiteTreshold" << _whiteThreshold;
-    fs.release();
+    fs << "httpTimeout" << _httpTimeout;
+    fs << "httpMaxBodySize" << _httpMaxBodySize;
+    fs << "captureThread" << _captureThread;
+    fs << "spoolAction" << _spoolAction;
+    fs << "spoolDoneDir" << _spoolDoneDir;
+    fs << "roiX" << _roiX;
+    fs << "roiY" << _roiY;
+    fs << "roiWidth" << _roiWidth;
+    fs << "roiHeight" << _roiHeight;
+    fs << "redSuppression" << _redSuppression;
+    fs << "skewRecheckInterval" << _skewRecheckInterval;
+    fs << "statsInterval" << _statsInterval;
+    fs << "statsFilename" << _statsFilename;
+    fs << "frameDiffThreshold" << _frameDiffThreshold;
+    fs << "digitChangeThreshold" << _digitChangeThreshold;
+    fs << "skewEngine" << _skewEngine;
+    fs << "knnEngine" << _knnEngine;
+    fs << "dedupMaxDist" << _dedupMaxDist;
+    fs << "ocrEngine" << _ocrEngine;
+    fs << "ocrMinMargin" << _ocrMinMargin;
 }
 
-void Config::loadConfig(std::string name = "") {
-    if name != ""
-        _configFilename = name;
-    cv::FileStorage fs(_configFilename, cv::FileStorage::READ);
-    if (fs.isOpened()) {
-        fs["trainingDataFilename"] >> _trainingDataFilename;
-        fs["meterDataFilename"] >> _meterDataFilename;
-        fs["logFilename"] >> _logFilename;
-        fs["meterValueMask"] >> _meterValueMask;
-        fs["meterValueLength"] >> _meterValueLength;
-        fs["meterValueDecimals"] >> _meterValueDecimals;
-        fs["meterMaxPower"] >> _meterMaxPower;
-        fs["meterWindow"] >> _meterWindow;
-        fs["rotationDegrees"] >> _rotationDegrees;
-        fs["cannyThreshold1"] >> _cannyThreshold1;
-        fs["cannyThreshold2"] >> _cannyThreshold2;
-        fs["digitMinHeight"] >> _digitMinHeight;
-        fs["digitMaxHeight"] >> _digitMaxHeight;
-        fs["digitYAlignment"] >> _digitYAlignment;
-        fs["ocrMaxDist"] >> _ocrMaxDist;
-        fs["whiteTreshold"] >> _whiteThreshold;
-        fs.release();
-    } else {
-        // no config file - create an initial one with default values
-        saveConfig();
-    }
+/**
+ * Read the values of the top level or of a meter.
+ * Missing values keep their current setting.
+ */
+void Config::readValues(const cv::FileNode & node) {
+    readOptional(node["trainingDataFilename"], _trainingDataFilename);
+    readOptional(node["meterDataFilename"], _meterDataFilename);
+    readOptional(node["logFilename"], _logFilename);
+    readOptional(node["meterValueMask"], _meterValueMask);
+    readOptional(node["meterValueLength"], _meterValueLength);
+    readOptional(node["meterValueDecimals"], _meterValueDecimals);
+    readOptional(node["meterMaxPower"], _meterMaxPower);
+    readOptional(node["meterWindow"], _meterWindow);
+    readOptional(node["rotationDegrees"], _rotationDegrees);
+    readOptional(node["cannyThreshold1"], _cannyThreshold1);
+    readOptional(node["cannyThreshold2"], _cannyThreshold2);
+    readOptional(node["digitMinHeight"], _digitMinHeight);
+    readOptional(node["digitMaxHeight"], _digitMaxHeight);
+    readOptional(node["digitYAlignment"], _digitYAlignment);
+    readOptional(node["ocrMaxDist"], _ocrMaxDist);
+    readOptional(node["whiteTreshold"], _whiteThreshold);
+    readOptional(node["httpTimeout"], _httpTimeout);
+    readOptional(node["httpMaxBodySize"], _httpMaxBodySize);
+    readOptional(node["captureThread"], _captureThread);
+    readOptional(node["spoolAction"], _spoolAction);
+    readOptional(node["spoolDoneDir"], _spoolDoneDir);
+    readOptional(node["roiX"], _roiX);
+    readOptional(node["roiY"], _roiY);
+    readOptional(node["roiWidth"], _roiWidth);
+    readOptional(node["roiHeight"], _roiHeight);
+    readOptional(node["redSuppression"], _redSuppression);
+    readOptional(node["skewRecheckInterval"], _skewRecheckInterval);
+    readOptional(node["statsInterval"], _statsInterval);
+    readOptional(node["statsFilename"], _statsFilename);
+    readOptional(node["frameDiffThreshold"], _frameDiffThreshold);
+    readOptional(node["digitChangeThreshold"], _digitChangeThreshold);
+    readOptional(node["skewEngine"], _skewEngine);
+    readOptional(node["knnEngine"], _knnEngine);
+    readOptional(node["dedupMaxDist"], _dedupMaxDist);
+    readOptional(node["ocrEngine"], _ocrEngine);
+    readOptional(node["ocrMinMargin"], _ocrMinMargin);
 }
 
 void Config::setConfigFilename(std::string name) {
     _configFilename=name;
 }
 
+void Config::setMeterDataFilename(const std::string & name) {
+    _meterDataFilename = name;
+}
+
+/**
+ * Set spoolAction and spoolDoneDir.
+ */
+void Config::setSpool(const std::string & action, const std::string & doneDir) {
+    _spoolAction = action;
+    _spoolDoneDir = doneDir;
+}
+
+/**
+ * Set the region of interest of the counter. Width or height 0 selects the whole image.
+ */
+void Config::setRoi(int x, int y, int width, int height) {
+    _roiX = x;
+    _roiY = y;
+    _roiWidth = width;
+    _roiHeight = height;
+}
@@ -7,8 +7,14 @@
 #define CONFIG_H_
 
 #include <string>
+#include <vector>
 #include <regex>
 
+namespace cv {
+class FileNode;
+class FileStorage;
+}
+
 class Config {
 public:
     Config();
@@ -19,6 +25,21 @@ public:
         return _configFilename;
     }
 
+    /**
+     * Name of a meter, empty for the top level config.
+     */
+    std::string getName() const {
+        return _name;
+    }
+
+    /**
+     * Configs of the meters that are read from one image.
+     * Empty if the top level config describes the only meter.
+     */
+    const std::vector<Config> & getMeters() const {
+        return _meters;
+    }
+
     int getDigitMaxHeight() const {
         return _digitMaxHeight;
     }
@@ -83,8 +104,100 @@ public:
         return _whiteThreshold;
     }
 
+    int getHttpTimeout() const {
+        return _httpTimeout;
+    }
+
+    int getHttpMaxBodySize() const {
+        return _httpMaxBodySize;
+    }
+
+    int getCaptureThread() const {
+        return _captureThread;
+    }
+
+    std::string getSpoolAction() const {
+        return _spoolAction;
+    }
+
+    std::string getSpoolDoneDir() const {
+        return _spoolDoneDir;
+    }
+
+    int getRoiX() const {
+        return _roiX;
+    }
+
+    int getRoiY() const {
+        return _roiY;
+    }
+
+    int getRoiWidth() const {
+        return _roiWidth;
+    }
+
+    int getRoiHeight() const {
+        return _roiHeight;
+    }
+
+    int getRedSuppression() const {
+        return _redSuppression;
+    }
+
+    int getSkewRecheckInterval() const {
+        return _skewRecheckInterval;
+    }
+
+    int getStatsInterval() const {
+        return _statsInterval;
+    }
+
+    std::string getStatsFilename() const {
+        return _statsFilename;
+    }
+
+    float getFrameDiffThreshold() const {
+        return _frameDiffThreshold;
+    }
+
+    float getDigitChangeThreshold() const {
+        return _digitChangeThreshold;
+    }
+
+    std::string getSkewEngine() const {
+        return _skewEngine;
+    }
+
+    std::string getKnnEngine() const {
+        return _knnEngine;
+    }
+
+    float getDedupMaxDist() const {
+        return _dedupMaxDist;
+    }
+
+    std::string getOcrEngine() const {
+        return _ocrEngine;
+    }
+
+    float getOcrMinMargin() const {
+        return _ocrMinMargin;
+    }
+
+    void setRoi(int x, int y, int width, int height);
+
+    void setConfigFilename(std::string name);
+
+    void setMeterDataFilename(const std::string & name);
+
+    void setSpool(const std::string & action, const std::string & doneDir);
+
 private:
+    void writeValues(cv::FileStorage & fs) const;
+    void readValues(const cv::FileNode & node);
+
     std::string _configFilename;
+    std::string _name;
     std::string _trainingDataFilename;
     std::string _meterDataFilename;
     std::string _logFilename;
@@ -101,6 +214,27 @@ private:
     int _cannyThreshold1;
     int _cannyThreshold2;
     int _whiteThreshold;
+    int _httpTimeout;
+    int _httpMaxBodySize;
+    int _captureThread;
+    std::string _spoolAction;
+    std::string _spoolDoneDir;
+    int _roiX;
+    int _roiY;
+    int _roiWidth;
+    int _roiHeight;
+    int _redSuppression;
+    int _skewRecheckInterval;
+    int _statsInterval;
+    std::string _statsFilename;
+    float _frameDiffThreshold;
+    float _digitChangeThreshold;
+    std::string _skewEngine;
+    std::string _knnEngine;
+    float _dedupMaxDist;
+    std::string _ocrEngine;
+    float _ocrMinMargin;
+    std::vector<Config> _meters;
 	};
 
 #endif /* CONFIG_H_ */
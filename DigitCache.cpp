@@ -0,0 +1,62 @@
+/*
+ * DigitCache.cpp
+ *
+ */
+
+#include <log4cpp/Category.hh>
+#include <log4cpp/Priority.hh>
+
+#include "DigitCache.h"
+#include "Stats.h"
+
+DigitCache::DigitCache(const Config & config) :
+        _config(config) {
+}
+
+/**
+ * Recognize a vector of digits, reusing the characters of unchanged slots.
+ * A slot is unchanged if the squared distance of its sample to the cached one
+ * is not above digitChangeThreshold (same unit as ocrMaxDist).
+ * All slots are classified again if the number of digits changed.
+ */
+std::string DigitCache::recognize(Ocr & ocr, const std::vector<cv::Mat> & images) {
+    if (_slots.size() != images.size()) {
+        _slots.assign(images.size(), Slot());
+    }
+    double threshold = _config.getDigitChangeThreshold();
+    std::string result;
+    int reused = 0;
+    // the changed digits are classified together
+    cv::Mat changed;
+    std::vector<size_t> changedSlots;
+    for (size_t i = 0; i < images.size(); ++i) {
+        Slot & slot = _slots[i];
+        cv::Mat sample = ocr.prepareSample(images[i]);
+        if (!slot.sample.empty() && cv::norm(sample, slot.sample, cv::NORM_L2SQR) <= threshold) {
+            ++reused;
+        } else {
+            slot.sample = sample;
+            changed.push_back(sample);
+            changedSlots.push_back(i);
+        }
+    }
+    if (!changedSlots.empty()) {
+        std::string values = ocr.recognizeSamples(changed);
+        for (size_t c = 0; c < changedSlots.size(); ++c) {
+            _slots[changedSlots[c]].value = values[c];
+        }
+    }
+    for (size_t i = 0; i < _slots.size(); ++i) {
+        result += _slots[i].value;
+    }
+    stats.countDigits((int) images.size(), reused);
+    log4cpp::Category::getRoot().debug("digits reused: %d of %d", reused, (int) images.size());
+    return result;
+}
+
+/**
+ * Forget all slots, e.g. after the training data changed.
+ */
+void DigitCache::clear() {
+    _slots.clear();
+}
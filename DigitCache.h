@@ -0,0 +1,40 @@
+/*
+ * DigitCache.h
+ *
+ */
+
+#ifndef DIGITCACHE_H_
+#define DIGITCACHE_H_
+
+#include <vector>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+#include "Config.h"
+#include "Ocr.h"
+
+/**
+ * Remembers the sample and the recognized character of each digit slot of the
+ * counter, from left to right. Only digits whose sample changed are classified
+ * again, usually just the rightmost wheels.
+ * One cache per counter; the OCR may be shared.
+ */
+class DigitCache {
+public:
+    DigitCache(const Config & config = ::config);
+
+    std::string recognize(Ocr & ocr, const std::vector<cv::Mat> & images);
+    void clear();
+
+private:
+    struct Slot {
+        cv::Mat sample;
+        char value;
+    };
+
+    const Config & _config;
+    std::vector<Slot> _slots;
+};
+
+#endif /* DIGITCACHE_H_ */
@@ -38,6 +38,17 @@ std::string Directory::fullpath(const std::string filename) {
     return path;
 }
 
+std::string Directory::getPath() const {
+    return _path;
+}
+
+/**
+ * Check if filename has the extension of this directory listing.
+ */
+bool Directory::matches(const std::string & filename) {
+    return hasExtension(filename.c_str(), _extension.c_str());
+}
+
 bool Directory::hasExtension(const char* name, const char* ext) {
     if (NULL == name || NULL == ext) {
         return false;
@@ -15,6 +15,8 @@ public:
 
     std::list<std::string> list();
     std::string fullpath(const std::string filename);
+    std::string getPath() const;
+    bool matches(const std::string & filename);
 private:
     bool hasExtension(const char* name, const char* ext);
 
@@ -0,0 +1,63 @@
+/*
+ * FrameBuffer.cpp
+ *
+ */
+
+#include "FrameBuffer.h"
+
+FrameBuffer::FrameBuffer() :
+        _back(0), _front(1), _middle(2), _published(0), _dropped(0) {
+    for (int i = 0; i < 3; ++i) {
+        _slots[i].time = 0;
+        _slots[i].stamp = 0;
+    }
+}
+
+/**
+ * Slot owned by the writer. Only valid until the next publish().
+ */
+FrameBuffer::Frame & FrameBuffer::writeSlot() {
+    return _slots[_back];
+}
+
+/**
+ * Publish the write slot as latest frame and take over the previous middle slot.
+ */
+void FrameBuffer::publish() {
+    int old = _middle.exchange(_back | FRESH, std::memory_order_acq_rel);
+    if (old & FRESH) {
+        // previous frame was never read
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    _back = old & ~FRESH;
+    _published.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Take the latest published frame into the read slot.
+ * Returns false if no new frame was published since the last call,
+ * the read slot keeps the previous frame then.
+ */
+bool FrameBuffer::read() {
+    if (!(_middle.load(std::memory_order_acquire) & FRESH)) {
+        return false;
+    }
+    int old = _middle.exchange(_front, std::memory_order_acq_rel);
+    _front = old & ~FRESH;
+    return true;
+}
+
+/**
+ * Slot owned by the reader. Only valid until the next read().
+ */
+const FrameBuffer::Frame & FrameBuffer::readSlot() const {
+    return _slots[_front];
+}
+
+unsigned long FrameBuffer::getPublished() const {
+    return _published.load(std::memory_order_relaxed);
+}
+
+unsigned long FrameBuffer::getDropped() const {
+    return _dropped.load(std::memory_order_relaxed);
+}
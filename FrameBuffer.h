@@ -0,0 +1,50 @@
+/*
+ * FrameBuffer.h
+ *
+ */
+
+#ifndef FRAMEBUFFER_H_
+#define FRAMEBUFFER_H_
+
+#include <ctime>
+#include <atomic>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * Lock-free single producer / single consumer buffer that always hands out
+ * the latest frame (triple buffering).
+ * The writer fills its back slot and publishes it, the reader takes the most
+ * recently published slot. Neither side ever waits for the other; frames that
+ * are overwritten before the reader takes them are counted as dropped.
+ */
+class FrameBuffer {
+public:
+    struct Frame {
+        cv::Mat img;
+        time_t time;
+        long long stamp;   // monotonic capture time in ms
+    };
+
+    FrameBuffer();
+
+    Frame & writeSlot();
+    void publish();
+    bool read();
+    const Frame & readSlot() const;
+
+    unsigned long getPublished() const;
+    unsigned long getDropped() const;
+
+private:
+    static const int FRESH = 4;
+
+    Frame _slots[3];
+    int _back;
+    int _front;
+    std::atomic<int> _middle;
+    std::atomic<unsigned long> _published;
+    std::atomic<unsigned long> _dropped;
+};
+
+#endif /* FRAMEBUFFER_H_ */
@@ -0,0 +1,555 @@
+/*
+ * HttpClient.cpp
+ *
+ * Keep-alive HTTP/1.1 client on a non-blocking socket.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <strings.h>
+
+#include "HttpClient.h"
+
+static const size_t READ_CHUNK = 65536;
+static const size_t MAX_HEADER_SIZE = 65536;
+static const size_t DEFAULT_MAX_BODY_SIZE = 16 * 1024 * 1024;
+
+static std::string trim(const std::string & str) {
+    size_t first = str.find_first_not_of(" \t");
+    if (first == std::string::npos) {
+        return "";
+    }
+    size_t last = str.find_last_not_of(" \t\r");
+    return str.substr(first, last - first + 1);
+}
+
+HttpClient::HttpClient(const std::string & url) :
+        _url(url), _valid(true), _addrLen(0), _fd(-1), _state(IDLE), _reused(false), _retried(false), _deadline(0),
+        _sent(0), _rpos(0), _bodyMode(BODY_NONE), _remaining(0), _maxBodySize(DEFAULT_MAX_BODY_SIZE),
+        _chunkCrlf(false), _chunkTrailer(false),
+        _keepAlive(false), _status(0) {
+    memset(&_addr, 0, sizeof(_addr));
+    if (!parseUrl(url)) {
+        _valid = false;
+        _error = "unsupported url: " + url;
+    }
+}
+
+HttpClient::~HttpClient() {
+    closeConnection();
+}
+
+/**
+ * Current time of the monotonic clock in milliseconds.
+ */
+long long HttpClient::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000LL + ts.tv_nsec / 1000000L;
+}
+
+/**
+ * Split url into host, port and path. Only plain http is supported.
+ */
+bool HttpClient::parseUrl(const std::string & url) {
+    std::string rest = url;
+    if (rest.compare(0, 7, "http://") == 0) {
+        rest = rest.substr(7);
+    } else if (rest.find("://") != std::string::npos) {
+        return false;
+    }
+    size_t slash = rest.find('/');
+    std::string hostport = rest.substr(0, slash);
+    _path = (slash == std::string::npos) ? "/" : rest.substr(slash);
+    size_t at = hostport.rfind('@');
+    if (at != std::string::npos) {
+        hostport = hostport.substr(at + 1);
+    }
+    size_t colon = hostport.rfind(':');
+    if (colon != std::string::npos) {
+        _host = hostport.substr(0, colon);
+        _port = hostport.substr(colon + 1);
+    } else {
+        _host = hostport;
+        _port = "80";
+    }
+    return !_host.empty() && !_port.empty();
+}
+
+/**
+ * Resolve the host name once and keep the address for reconnects.
+ */
+bool HttpClient::resolve() {
+    if (_addrLen > 0) {
+        return true;
+    }
+    struct addrinfo hints, *res = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(_host.c_str(), _port.c_str(), &hints, &res);
+    if (rc != 0 || res == 0) {
+        _error = "cannot resolve " + _host + ": " + gai_strerror(rc);
+        return false;
+    }
+    memcpy(&_addr, res->ai_addr, res->ai_addrlen);
+    _addrLen = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+void HttpClient::openConnection() {
+    closeConnection();
+    _reused = false;
+    if (_host.empty()) {
+        _error = "unsupported url: " + _url;
+        _state = FAILED;
+        return;
+    }
+    if (!resolve()) {
+        _state = FAILED;
+        return;
+    }
+    _fd = socket(_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_fd < 0) {
+        fail(std::string("socket: ") + strerror(errno));
+        return;
+    }
+    int one = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(_fd, (struct sockaddr*) &_addr, _addrLen) == 0) {
+        _state = SENDING;
+    } else if (errno == EINPROGRESS) {
+        _state = CONNECTING;
+    } else {
+        fail(std::string("connect: ") + strerror(errno));
+    }
+}
+
+void HttpClient::closeConnection() {
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+}
+
+/**
+ * Abort the current request. A request on a reused keep-alive connection that
+ * failed before any response byte arrived is retried once on a fresh connection,
+ * because the server may have closed the idle connection in the meantime.
+ */
+void HttpClient::fail(const std::string & error) {
+    closeConnection();
+    if (_reused && !_retried && _status == 0 && _rbuf.empty()) {
+        _retried = true;
+        _sent = 0;
+        openConnection();
+        if (_state != FAILED) {
+            return;
+        }
+    }
+    _error = error;
+    _state = FAILED;
+}
+
+/**
+ * Start a GET request. The connection of the previous request is reused if
+ * it is still open.
+ */
+void HttpClient::startRequest(int timeoutMs) {
+    _deadline = now() + timeoutMs;
+    _status = 0;
+    _body.clear();
+    _error.clear();
+    _rbuf.clear();
+    _rpos = 0;
+    _sent = 0;
+    _retried = false;
+    _newEtag.clear();
+    _newLastModified.clear();
+
+    _request = "GET " + _path + " HTTP/1.1\r\nHost: " + _host;
+    if (_port != "80") {
+        _request += ":" + _port;
+    }
+    _request += "\r\nUser-Agent: ocmeter\r\nAccept: image/*\r\nConnection: keep-alive\r\n";
+    if (!_etag.empty()) {
+        _request += "If-None-Match: " + _etag + "\r\n";
+    }
+    if (!_lastModified.empty()) {
+        _request += "If-Modified-Since: " + _lastModified + "\r\n";
+    }
+    _request += "\r\n";
+
+    if (_fd >= 0) {
+        _reused = true;
+        _state = SENDING;
+    } else {
+        openConnection();
+    }
+}
+
+/**
+ * Run a request to completion or until the timeout expires.
+ */
+bool HttpClient::get(int timeoutMs) {
+    startRequest(timeoutMs);
+    while (_state == CONNECTING || _state == SENDING || _state == RECEIVING) {
+        long long remaining = _deadline - now();
+        if (remaining <= 0) {
+            checkTimeout();
+            break;
+        }
+        struct pollfd pfd;
+        pfd.fd = _fd;
+        pfd.events = getPollEvents();
+        pfd.revents = 0;
+        int rc = poll(&pfd, 1, (int) remaining);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            _retried = true;
+            fail(std::string("poll: ") + strerror(errno));
+        } else if (rc > 0) {
+            handleEvents(pfd.revents);
+        }
+    }
+    return _state == DONE;
+}
+
+/**
+ * Fail responses with a body larger than size bytes instead of buffering them.
+ */
+void HttpClient::setMaxBodySize(size_t size) {
+    _maxBodySize = size;
+}
+
+/**
+ * Advance the request after poll() reported events on getFd().
+ */
+void HttpClient::handleEvents(short revents) {
+    if ((_state == CONNECTING || _state == SENDING) && (revents & (POLLOUT | POLLERR | POLLHUP))) {
+        onWritable();
+    } else if (_state == RECEIVING && (revents & (POLLIN | POLLERR | POLLHUP))) {
+        onReadable();
+    }
+}
+
+/**
+ * Fail the running request if its deadline has passed.
+ */
+bool HttpClient::checkTimeout() {
+    if ((_state == CONNECTING || _state == SENDING || _state == RECEIVING) && now() >= _deadline) {
+        _retried = true;
+        fail("timeout");
+        return true;
+    }
+    return false;
+}
+
+void HttpClient::onWritable() {
+    if (_state == CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+            fail(std::string("connect: ") + strerror(err ? err : errno));
+            return;
+        }
+        _state = SENDING;
+    }
+    while (_sent < _request.size()) {
+        ssize_t n = send(_fd, _request.data() + _sent, _request.size() - _sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            fail(std::string("send: ") + strerror(errno));
+            return;
+        }
+        _sent += n;
+    }
+    _state = RECEIVING;
+}
+
+void HttpClient::onReadable() {
+    for (;;) {
+        size_t old = _rbuf.size();
+        _rbuf.resize(old + READ_CHUNK);
+        ssize_t n = recv(_fd, &_rbuf[old], READ_CHUNK, 0);
+        _rbuf.resize(old + (n > 0 ? n : 0));
+        if (n == 0) {
+            if (_status != 0 && _bodyMode == BODY_CLOSE) {
+                finish();
+            } else {
+                fail("connection closed by server");
+            }
+            return;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            fail(std::string("recv: ") + strerror(errno));
+            return;
+        }
+        if (_status == 0 && !parseHeader()) {
+            if (_state != RECEIVING) {
+                return;
+            }
+            continue;
+        }
+        if (_state == RECEIVING && parseBody()) {
+            finish();
+        }
+        if (_state != RECEIVING) {
+            return;
+        }
+        // drop consumed bytes from the receive buffer
+        if (_rpos == _rbuf.size()) {
+            _rbuf.clear();
+            _rpos = 0;
+        } else if (_rpos >= READ_CHUNK) {
+            _rbuf.erase(_rbuf.begin(), _rbuf.begin() + _rpos);
+            _rpos = 0;
+        }
+    }
+}
+
+/**
+ * Parse status line and headers. Returns false if the header is not complete yet.
+ */
+bool HttpClient::parseHeader() {
+    static const char crlf2[] = "\r\n\r\n";
+    std::vector<char>::iterator end = std::search(_rbuf.begin(), _rbuf.end(), crlf2, crlf2 + 4);
+    if (end == _rbuf.end()) {
+        if (_rbuf.size() > MAX_HEADER_SIZE) {
+            fail("response header too large");
+        }
+        return false;
+    }
+    std::string header(_rbuf.begin(), end);
+    _rpos = end - _rbuf.begin() + 4;
+
+    size_t eol = header.find("\r\n");
+    std::string statusLine = header.substr(0, eol);
+    if (statusLine.compare(0, 7, "HTTP/1.") != 0 || statusLine.size() < 12) {
+        fail("invalid status line: " + statusLine);
+        return false;
+    }
+    int status = atoi(statusLine.c_str() + 9);
+    _keepAlive = (statusLine[7] == '1');
+
+    bool chunked = false;
+    long contentLength = -1;
+    while (eol != std::string::npos) {
+        size_t start = eol + 2;
+        eol = header.find("\r\n", start);
+        std::string line = header.substr(start, eol == std::string::npos ? std::string::npos : eol - start);
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = line.substr(0, colon);
+        std::string value = trim(line.substr(colon + 1));
+        if (strcasecmp(name.c_str(), "Content-Length") == 0) {
+            contentLength = atol(value.c_str());
+        } else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0) {
+            chunked = (strcasecmp(value.c_str(), "identity") != 0);
+        } else if (strcasecmp(name.c_str(), "Connection") == 0) {
+            if (strcasecmp(value.c_str(), "close") == 0) {
+                _keepAlive = false;
+            } else if (strcasecmp(value.c_str(), "keep-alive") == 0) {
+                _keepAlive = true;
+            }
+        } else if (strcasecmp(name.c_str(), "ETag") == 0) {
+            _newEtag = value;
+        } else if (strcasecmp(name.c_str(), "Last-Modified") == 0) {
+            _newLastModified = value;
+        }
+    }
+
+    if (status >= 100 && status < 200) {
+        // interim response: skip it and wait for the final one
+        _rbuf.erase(_rbuf.begin(), _rbuf.begin() + _rpos);
+        _rpos = 0;
+        return parseHeader();
+    }
+    _status = status;
+
+    _chunkCrlf = false;
+    _chunkTrailer = false;
+    _remaining = 0;
+    if (status == 204 || status == 304) {
+        _bodyMode = BODY_NONE;
+    } else if (chunked) {
+        _bodyMode = BODY_CHUNKED;
+    } else if (contentLength >= 0) {
+        if ((unsigned long) contentLength > _maxBodySize) {
+            fail("response body too large: " + std::to_string(contentLength) + " bytes");
+            return false;
+        }
+        _bodyMode = BODY_LENGTH;
+        _remaining = contentLength;
+        _body.reserve(contentLength);
+    } else {
+        _bodyMode = BODY_CLOSE;
+        _keepAlive = false;
+    }
+    return true;
+}
+
+/**
+ * Move received body bytes to the body buffer. Returns true if the body is complete.
+ */
+bool HttpClient::parseBody() {
+    size_t avail = _rbuf.size() - _rpos;
+    switch (_bodyMode) {
+    case BODY_NONE:
+        return true;
+    case BODY_CLOSE:
+        if (_body.size() + avail > _maxBodySize) {
+            fail("response body too large");
+            return false;
+        }
+        _body.insert(_body.end(), _rbuf.begin() + _rpos, _rbuf.end());
+        _rpos = _rbuf.size();
+        return false;
+    case BODY_LENGTH: {
+        size_t n = std::min(avail, _remaining);
+        _body.insert(_body.end(), _rbuf.begin() + _rpos, _rbuf.begin() + _rpos + n);
+        _rpos += n;
+        _remaining -= n;
+        return _remaining == 0;
+    }
+    case BODY_CHUNKED:
+        for (;;) {
+            avail = _rbuf.size() - _rpos;
+            if (_remaining > 0) {
+                size_t n = std::min(avail, _remaining);
+                _body.insert(_body.end(), _rbuf.begin() + _rpos, _rbuf.begin() + _rpos + n);
+                _rpos += n;
+                _remaining -= n;
+                if (_remaining > 0) {
+                    return false;
+                }
+                _chunkCrlf = true;
+                continue;
+            }
+            if (_chunkCrlf) {
+                if (avail < 2) {
+                    return false;
+                }
+                _rpos += 2;
+                _chunkCrlf = false;
+                continue;
+            }
+            std::vector<char>::iterator lineStart = _rbuf.begin() + _rpos;
+            std::vector<char>::iterator lineEnd = std::find(lineStart, _rbuf.end(), '\n');
+            if (lineEnd == _rbuf.end()) {
+                return false;
+            }
+            std::string line(lineStart, lineEnd);
+            _rpos = lineEnd - _rbuf.begin() + 1;
+            if (_chunkTrailer) {
+                if (trim(line).empty()) {
+                    return true;
+                }
+            } else {
+                size_t size = strtoul(line.c_str(), 0, 16);
+                if (size == 0) {
+                    _chunkTrailer = true;
+                } else if (size > _maxBodySize - _body.size()) {
+                    fail("response body too large");
+                    return false;
+                } else {
+                    _remaining = size;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+void HttpClient::finish() {
+    if (_status == 200) {
+        _etag = _newEtag;
+        _lastModified = _newLastModified;
+    }
+    _rbuf.clear();
+    _rpos = 0;
+    if (!_keepAlive) {
+        closeConnection();
+    }
+    _state = DONE;
+}
+
+int HttpClient::getFd() const {
+    return _fd;
+}
+
+short HttpClient::getPollEvents() const {
+    switch (_state) {
+    case CONNECTING:
+    case SENDING:
+        return POLLOUT;
+    case RECEIVING:
+        return POLLIN;
+    default:
+        return 0;
+    }
+}
+
+long long HttpClient::getDeadline() const {
+    return _deadline;
+}
+
+HttpClient::State HttpClient::getState() const {
+    return _state;
+}
+
+/**
+ * HTTP status code of the last response.
+ */
+int HttpClient::getStatus() const {
+    return _status;
+}
+
+/**
+ * True if the server answered the conditional request with 304.
+ */
+bool HttpClient::isNotModified() const {
+    return _status == 304;
+}
+
+const std::vector<unsigned char> & HttpClient::getBody() const {
+    return _body;
+}
+
+const std::string & HttpClient::getError() const {
+    return _error;
+}
+
+const std::string & HttpClient::getUrl() const {
+    return _url;
+}
+
+/**
+ * False if the url is not supported, requests will always fail.
+ */
+bool HttpClient::isValid() const {
+    return _valid;
+}
@@ -0,0 +1,98 @@
+/*
+ * HttpClient.h
+ *
+ */
+
+#ifndef HTTPCLIENT_H_
+#define HTTPCLIENT_H_
+
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+
+/**
+ * Minimal HTTP/1.1 client to fetch images from a web server or ip camera.
+ * The connection is kept alive between requests and conditional requests
+ * (ETag, Last-Modified) are sent when the server provided a validator.
+ * The socket is non-blocking: get() runs a request to completion, while
+ * startRequest() / handleEvents() allow to drive many clients from one poll() loop.
+ */
+class HttpClient {
+public:
+    enum State {
+        IDLE, CONNECTING, SENDING, RECEIVING, DONE, FAILED
+    };
+
+    HttpClient(const std::string & url);
+    virtual ~HttpClient();
+
+    bool get(int timeoutMs);
+    void setMaxBodySize(size_t size);
+
+    void startRequest(int timeoutMs);
+    void handleEvents(short revents);
+    bool checkTimeout();
+    int getFd() const;
+    short getPollEvents() const;
+    long long getDeadline() const;
+    State getState() const;
+
+    int getStatus() const;
+    bool isNotModified() const;
+    const std::vector<unsigned char> & getBody() const;
+    const std::string & getError() const;
+    const std::string & getUrl() const;
+    bool isValid() const;
+
+    static long long now();
+
+private:
+    enum BodyMode {
+        BODY_NONE, BODY_LENGTH, BODY_CHUNKED, BODY_CLOSE
+    };
+
+    bool parseUrl(const std::string & url);
+    bool resolve();
+    void openConnection();
+    void closeConnection();
+    void fail(const std::string & error);
+    void onWritable();
+    void onReadable();
+    bool parseHeader();
+    bool parseBody();
+    void finish();
+
+    std::string _url;
+    bool _valid;
+    std::string _host;
+    std::string _port;
+    std::string _path;
+    std::string _etag;
+    std::string _lastModified;
+
+    struct sockaddr_storage _addr;
+    socklen_t _addrLen;
+    int _fd;
+    State _state;
+    bool _reused;
+    bool _retried;
+    long long _deadline;
+
+    std::string _request;
+    size_t _sent;
+    std::vector<char> _rbuf;
+    size_t _rpos;
+    BodyMode _bodyMode;
+    size_t _remaining;
+    size_t _maxBodySize;
+    bool _chunkCrlf;
+    bool _chunkTrailer;
+    bool _keepAlive;
+    int _status;
+    std::vector<unsigned char> _body;
+    std::string _error;
+    std::string _newEtag;
+    std::string _newLastModified;
+};
+
+#endif /* HTTPCLIENT_H_ */
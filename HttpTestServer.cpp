@@ -0,0 +1,155 @@
+/*
+ * HttpTestServer.cpp
+ *
+ */
+
+#include <cstring>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "HttpTestServer.h"
+
+HttpTestServer::HttpTestServer() :
+        _listenFd(-1), _port(0), _stop(false), _connections(0) {
+}
+
+HttpTestServer::~HttpTestServer() {
+    stop();
+}
+
+/**
+ * Listen on a free port of the loopback interface and serve on a thread.
+ */
+bool HttpTestServer::start() {
+    _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_listenFd < 0) {
+        return false;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (bind(_listenFd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(_listenFd, 4) != 0
+            || getsockname(_listenFd, (struct sockaddr*) &addr, &len) != 0) {
+        close(_listenFd);
+        _listenFd = -1;
+        return false;
+    }
+    _port = ntohs(addr.sin_port);
+    _stop = false;
+    _thread = std::thread(&HttpTestServer::run, this);
+    return true;
+}
+
+void HttpTestServer::stop() {
+    _stop = true;
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    if (_listenFd >= 0) {
+        close(_listenFd);
+        _listenFd = -1;
+    }
+}
+
+int HttpTestServer::getPort() const {
+    return _port;
+}
+
+/**
+ * Number of accepted connections.
+ */
+int HttpTestServer::getConnections() const {
+    return _connections;
+}
+
+/**
+ * Header of the last request received.
+ */
+std::string HttpTestServer::getLastRequest() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _lastRequest;
+}
+
+void HttpTestServer::run() {
+    while (!_stop) {
+        struct pollfd pfd = { _listenFd, POLLIN, 0 };
+        if (poll(&pfd, 1, 50) <= 0) {
+            continue;
+        }
+        int fd = accept(_listenFd, 0, 0);
+        if (fd >= 0) {
+            ++_connections;
+            serve(fd);
+            close(fd);
+        }
+    }
+}
+
+/**
+ * Answer the requests of a connection until the client closes it.
+ */
+void HttpTestServer::serve(int fd) {
+    std::string buffer;
+    char data[1024];
+    while (!_stop) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 50) <= 0) {
+            continue;
+        }
+        ssize_t n = recv(fd, data, sizeof(data), 0);
+        if (n <= 0) {
+            return;
+        }
+        buffer.append(data, n);
+        size_t end;
+        while ((end = buffer.find("\r\n\r\n")) != std::string::npos) {
+            std::string request = buffer.substr(0, end + 4);
+            buffer.erase(0, end + 4);
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _lastRequest = request;
+            }
+            respond(fd, request);
+        }
+    }
+}
+
+void HttpTestServer::respond(int fd, const std::string & request) {
+    std::string path = request.substr(request.find(' ') + 1);
+    path = path.substr(0, path.find(' '));
+    std::string response;
+    if (path == "/image") {
+        if (request.find("If-None-Match: \"v1\"") != std::string::npos) {
+            response = "HTTP/1.1 304 Not Modified\r\nETag: \"v1\"\r\n\r\n";
+        } else {
+            response = "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nETag: \"v1\"\r\n"
+                    "Content-Length: 10\r\n\r\n0123456789";
+        }
+    } else if (path == "/chunked") {
+        response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                "6\r\nhello \r\n8\r\nchunked \r\n5\r\nworld\r\n0\r\n\r\n";
+    } else if (path == "/large") {
+        response = "HTTP/1.1 200 OK\r\nContent-Length: 1073741824\r\n\r\n0123456789";
+    } else if (path == "/largechunked") {
+        response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n6\r\nhello \r\n40000000\r\n0123456789";
+    } else if (path == "/slow") {
+        return;
+    } else {
+        response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    }
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return;
+        }
+        sent += n;
+    }
+}
@@ -0,0 +1,52 @@
+/*
+ * HttpTestServer.h
+ *
+ */
+
+#ifndef HTTPTESTSERVER_H_
+#define HTTPTESTSERVER_H_
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+/**
+ * Stand-in HTTP server on 127.0.0.1 to check HttpClient (-B http).
+ * Serves one connection at a time with keep-alive:
+ *   /image         10 byte body with ETag "v1", 304 for If-None-Match: "v1"
+ *   /chunked       "hello chunked world" with chunked transfer encoding
+ *   /large         announces a 1 GiB Content-Length, sends 10 bytes
+ *   /largechunked  announces a 1 GiB chunk after a small one
+ *   /slow          never answers
+ * Everything else is 404.
+ */
+class HttpTestServer {
+public:
+    HttpTestServer();
+    ~HttpTestServer();
+
+    bool start();
+    void stop();
+    int getPort() const;
+    int getConnections() const;
+    std::string getLastRequest() const;
+
+private:
+    HttpTestServer(const HttpTestServer &);
+    HttpTestServer & operator=(const HttpTestServer &);
+
+    void run();
+    void serve(int fd);
+    void respond(int fd, const std::string & request);
+
+    int _listenFd;
+    int _port;
+    std::thread _thread;
+    std::atomic<bool> _stop;
+    std::atomic<int> _connections;
+    mutable std::mutex _mutex;
+    std::string _lastRequest;
+};
+
+#endif /* HTTPTESTSERVER_H_ */
@@ -7,6 +7,11 @@
 #include <string>
 #include <list>
 #include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -17,9 +22,30 @@
 #include "ImageInput.h"
 #include "Config.h"
 
+/**
+ * Monotonic time in milliseconds.
+ */
+static long long monotonicMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000LL + ts.tv_nsec / 1000000L;
+}
+
+ImageInput::ImageInput() :
+        _time(0), _skipped(false) {
+}
+
 ImageInput::~ImageInput() {
 }
 
+/**
+ * True if the last nextImage() could not fetch a new image, e.g. after a
+ * network error. The input goes on, the caller should skip the frame.
+ */
+bool ImageInput::isSkipped() const {
+    return _skipped;
+}
+
 cv::Mat& ImageInput::getImage() {
     return _img;
 }
@@ -54,39 +80,203 @@ bool DirectoryInput::nextImage() {
     if (_itFilename == _filenameList.end()) {
         return false;
     }
-    std::string path = _directory.fullpath(*_itFilename);
-
-    _img = cv::imread(path.c_str());
+    readFile(*_itFilename);
+    _itFilename++;
+    return true;
+}
 
-    // read time from file name
+/**
+ * Read time from file name (YYYYMMDD-hhmmss).
+ */
+time_t DirectoryInput::parseTime(const std::string & filename) {
     struct tm date;
     memset(&date, 0, sizeof(date));
-    date.tm_year = atoi(_itFilename->substr(0, 4).c_str()) - 1900;
-    date.tm_mon = atoi(_itFilename->substr(4, 2).c_str()) - 1;
-    date.tm_mday = atoi(_itFilename->substr(6, 2).c_str());
-    date.tm_hour = atoi(_itFilename->substr(9, 2).c_str());
-    date.tm_min = atoi(_itFilename->substr(11, 2).c_str());
-    date.tm_sec = atoi(_itFilename->substr(13, 2).c_str());
-    _time = mktime(&date);
+    date.tm_year = atoi(filename.substr(0, 4).c_str()) - 1900;
+    date.tm_mon = atoi(filename.substr(4, 2).c_str()) - 1;
+    date.tm_mday = atoi(filename.substr(6, 2).c_str());
+    date.tm_hour = atoi(filename.substr(9, 2).c_str());
+    date.tm_min = atoi(filename.substr(11, 2).c_str());
+    date.tm_sec = atoi(filename.substr(13, 2).c_str());
+    return mktime(&date);
+}
+
+/**
+ * Load image file of the directory and take its time from the file name.
+ */
+void DirectoryInput::readFile(const std::string & filename) {
+    std::string path = _directory.fullpath(filename);
+
+    _img = cv::imread(path.c_str());
 
-    log4cpp::Category::getRoot() << log4cpp::Priority::INFO << "Processing " << *_itFilename << " of " << ctime(&_time);
+    _time = parseTime(filename);
 
-	std::cout << "Processing " << *_itFilename << std::endl;
+    log4cpp::Category::getRoot() << log4cpp::Priority::INFO << "Processing " << filename << " of " << ctime(&_time);
+
+	std::cout << "Processing " << filename << std::endl;
 	
     // save copy of image if requested
     if (!_outDir.empty()) {
         saveImage();
     }
+}
 
-    _itFilename++;
+/**
+ * Streaming directory input: starts with the files already in the directory and
+ * then picks up new files announced by inotify, always the oldest one first.
+ */
+DirectoryWatchInput::DirectoryWatchInput(const Directory & directory) :
+        DirectoryInput(directory), _started(false), _usable(true) {
+    _pending.insert(_filenameList.begin(), _filenameList.end());
+    _filenameList.clear();
+    _itFilename = _filenameList.end();
+
+    _inotifyFd = inotify_init1(IN_CLOEXEC);
+    if (_inotifyFd < 0 || inotify_add_watch(_inotifyFd, _directory.getPath().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        log4cpp::Category::getRoot() << log4cpp::Priority::ERROR << "Cannot watch directory " << _directory.getPath()
+                << ": " << strerror(errno);
+        std::cout << "Cannot watch directory " << _directory.getPath() << std::endl;
+    }
+    // files finished between the listing of DirectoryInput and the watch
+    std::list<std::string> files = _directory.list();
+    _pending.insert(files.begin(), files.end());
+}
+
+DirectoryWatchInput::~DirectoryWatchInput() {
+    if (!_current.empty()) {
+        disposeFile(_current);
+    }
+    if (_inotifyFd >= 0) {
+        close(_inotifyFd);
+    }
+}
+
+bool DirectoryWatchInput::nextImage() {
+    // the config is loaded after the input is created
+    if (!_started) {
+        _started = true;
+        _usable = prepareDoneDir();
+    }
+    if (!_usable) {
+        return false;
+    }
+    // the previous image is processed when the next one is requested
+    if (!_current.empty()) {
+        disposeFile(_current);
+        _current.clear();
+    }
+    while (_pending.empty()) {
+        if (!waitForFiles()) {
+            return false;
+        }
+    }
+    _current = *_pending.begin();
+    _pending.erase(_pending.begin());
+    _lastTaken = _current;
+    readFile(_current);
     return true;
 }
 
-CameraInput::CameraInput(int device) {
+/**
+ * Block until inotify reports new files and add them to the pending set.
+ */
+bool DirectoryWatchInput::waitForFiles() {
+    if (_inotifyFd < 0) {
+        return false;
+    }
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len = read(_inotifyFd, buf, sizeof(buf));
+    if (len < 0) {
+        if (errno == EINTR) {
+            // interrupted by a quit signal
+            return false;
+        }
+        log4cpp::Category::getRoot() << log4cpp::Priority::ERROR << "inotify read failed: " << strerror(errno);
+        return false;
+    }
+    for (char* ptr = buf; ptr < buf + len;) {
+        const struct inotify_event* event = (const struct inotify_event*) ptr;
+        if (event->mask & IN_Q_OVERFLOW) {
+            // events were lost: fall back to a listing of the directory.
+            // Processed files may still be there (spoolAction keep), only newer ones are queued.
+            log4cpp::Category::getRoot() << log4cpp::Priority::WARN << "inotify queue overflow, rescanning directory";
+            std::list<std::string> files = _directory.list();
+            for (std::list<std::string>::const_iterator it = files.begin(); it != files.end(); ++it) {
+                if (*it > _lastTaken) {
+                    _pending.insert(*it);
+                }
+            }
+        } else if (event->len > 0 && _directory.matches(event->name)) {
+            _pending.insert(event->name);
+        }
+        ptr += sizeof(struct inotify_event) + event->len;
+    }
+    return true;
+}
+
+/**
+ * Prepare the target of spoolAction move: a relative spoolDoneDir is taken
+ * relative to the spool directory and created if it is missing.
+ * Returns false if the processed files cannot be moved there.
+ */
+bool DirectoryWatchInput::prepareDoneDir() {
+    if (config.getSpoolAction() != "move") {
+        return true;
+    }
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    _doneDir = config.getSpoolDoneDir();
+    if (_doneDir.empty()) {
+        rlog.error("spoolAction move needs a spoolDoneDir");
+        std::cout << "spoolAction move needs a spoolDoneDir" << std::endl;
+        return false;
+    }
+    if (_doneDir[0] != '/') {
+        _doneDir = _directory.fullpath(_doneDir);
+    }
+    struct stat st;
+    const char* reason = 0;
+    if (mkdir(_doneDir.c_str(), 0755) != 0 && errno != EEXIST) {
+        reason = strerror(errno);
+    } else if (stat(_doneDir.c_str(), &st) != 0) {
+        reason = strerror(errno);
+    } else if (!S_ISDIR(st.st_mode)) {
+        reason = "not a directory";
+    } else if (access(_doneDir.c_str(), W_OK | X_OK) != 0) {
+        reason = strerror(errno);
+    }
+    if (reason) {
+        rlog << log4cpp::Priority::ERROR << "Cannot move processed files to " << _doneDir << ": " << reason;
+        std::cout << "Cannot move processed files to " << _doneDir << ": " << reason << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Delete or move a processed file as configured by spoolAction, so that the
+ * spool directory does not grow.
+ */
+void DirectoryWatchInput::disposeFile(const std::string & filename) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    std::string path = _directory.fullpath(filename);
+    if (config.getSpoolAction() == "delete") {
+        if (unlink(path.c_str()) != 0) {
+            rlog << log4cpp::Priority::ERROR << "Cannot delete " << path << ": " << strerror(errno);
+        }
+    } else if (config.getSpoolAction() == "move") {
+        std::string target = _doneDir + "/" + filename;
+        if (rename(path.c_str(), target.c_str()) != 0) {
+            rlog << log4cpp::Priority::ERROR << "Cannot move " << path << " to " << target << ": " << strerror(errno);
+        }
+    }
+}
+
+CameraInput::CameraInput(int device) :
+        _stop(false), _failed(false), _captureThread(false), _frameAge(0) {
     _capture.open(device);
 }
 
-CameraInput::CameraInput(std::string url) {
+CameraInput::CameraInput(std::string url) :
+        _stop(false), _failed(false), _captureThread(false), _frameAge(0) {
 	std::cout << "Opening IP cam stream: " << url << std::endl;
 	log4cpp::Category::getRoot() << log4cpp::Priority::INFO << "Opening IP cam stream: " << url;
     _capture.open(url);
@@ -100,12 +290,79 @@ CameraInput::CameraInput(std::string url) {
     }
 }
 
-bool CameraInput::nextImage() {
-    time(&_time);
-    // read image from camera
-    bool success = _capture.read(_img);
+CameraInput::~CameraInput() {
+    stopCapture();
+}
 
-    log4cpp::Category::getRoot() << log4cpp::Priority::INFO << "Image captured: " << success;
+/**
+ * Start the background thread that continuously drains the camera.
+ */
+void CameraInput::startCapture() {
+    _stop = false;
+    _failed = false;
+    _thread = std::thread(&CameraInput::captureLoop, this);
+    log4cpp::Category::getRoot() << log4cpp::Priority::INFO << "Capture thread started";
+}
+
+void CameraInput::stopCapture() {
+    if (_thread.joinable()) {
+        _stop = true;
+        _thread.join();
+    }
+}
+
+/**
+ * Capture thread: grab every frame the driver delivers so that its buffer never
+ * fills up with stale frames, and publish it as the latest frame.
+ */
+void CameraInput::captureLoop() {
+    int failures = 0;
+    while (!_stop) {
+        if (!_capture.grab()) {
+            if (++failures >= 100) {
+                log4cpp::Category::getRoot() << log4cpp::Priority::ERROR << "Capture thread: camera stopped delivering frames";
+                _failed = true;
+                return;
+            }
+            usleep(10000);
+            continue;
+        }
+        failures = 0;
+        FrameBuffer::Frame & frame = _buffer.writeSlot();
+        if (_capture.retrieve(frame.img)) {
+            time(&frame.time);
+            frame.stamp = monotonicMs();
+            _buffer.publish();
+        }
+    }
+}
+
+bool CameraInput::nextImage() {
+    bool success;
+    if (_captureThread || config.getCaptureThread()) {
+        if (!_thread.joinable()) {
+            startCapture();
+        }
+        // wait for the very first frame only, later calls never block
+        while (_buffer.getPublished() == 0 && !_failed) {
+            usleep(10000);
+        }
+        bool fresh = _buffer.read();
+        success = !_failed && _buffer.getPublished() > 0;
+        if (success) {
+            const FrameBuffer::Frame & frame = _buffer.readSlot();
+            frame.img.copyTo(_img);
+            _time = frame.time;
+            _frameAge = monotonicMs() - frame.stamp;
+            log4cpp::Category::getRoot() << log4cpp::Priority::INFO << "Image captured: " << (fresh ? "new" : "repeated")
+                    << " frame, age " << _frameAge << " ms, dropped " << _buffer.getDropped();
+        }
+    } else {
+        time(&_time);
+        // read image from camera
+        success = _capture.read(_img);
+        log4cpp::Category::getRoot() << log4cpp::Priority::INFO << "Image captured: " << success;
+    }
 
     // save copy of image if requested
     if (success && !_outDir.empty()) {
@@ -115,23 +372,87 @@ bool CameraInput::nextImage() {
     return success;
 }
 
-URLInput::URLInput(std::string url) {
+/**
+ * Grab frames on a separate thread regardless of the captureThread config value.
+ * Must be set before the first call of nextImage().
+ */
+void CameraInput::captureThread(bool bval) {
+    _captureThread = bval;
+}
+
+/**
+ * Number of frames grabbed by the capture thread but never returned by nextImage().
+ */
+unsigned long CameraInput::getDroppedFrames() const {
+    return _buffer.getDropped();
+}
+
+/**
+ * Age of the current image in ms at the time nextImage() returned it.
+ */
+long long CameraInput::getFrameAge() const {
+    return _frameAge;
+}
+
+URLInput::URLInput(std::string url) :
+        _http(url) {
 	std::cout << "URL access to picture: " << url << std::endl;
 	log4cpp::Category::getRoot() << log4cpp::Priority::INFO << "URL access to picture: " << url;
-    _urlImageSource = url;
 }
 
+/**
+ * Download the next image. A failed download only skips the frame,
+ * false is returned only if the url cannot be used at all.
+ */
 bool URLInput::nextImage() {
-    int ret;
+    if (!_http.isValid()) {
+        log4cpp::Category::getRoot() << log4cpp::Priority::ERROR << _http.getError();
+        return false;
+    }
 	time(&_time);
-    // download image from url
-    ret = system(("wget -q -O " + config.getMeterDataFilename() + ".jpg " + _urlImageSource).c_str());
+    // download image from url, reusing the connection of the previous request
+    _http.setMaxBodySize(config.getHttpMaxBodySize());
+    _http.get(config.getHttpTimeout());
+    _skipped = !decodeResponse();
+    return true;
+}
 
-	// load image
-    _img = cv::imread(config.getMeterDataFilename() + ".jpg");
-    log4cpp::Category::getRoot() << log4cpp::Priority::INFO << "Image captured: " << ret;
+/**
+ * Start the download of the next image without waiting for it.
+ * The HTTP client has to be driven by the caller until the request is finished,
+ * then decodeResponse() takes over the image.
+ */
+void URLInput::startRequest() {
+    time(&_time);
+    _http.setMaxBodySize(config.getHttpMaxBodySize());
+    _http.startRequest(config.getHttpTimeout());
+}
 
-	ret = system(("rm " + config.getMeterDataFilename() + ".jpg ").c_str());
+/**
+ * Take the image of the finished request.
+ */
+bool URLInput::decodeResponse() {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    if (_http.getState() != HttpClient::DONE) {
+        rlog << log4cpp::Priority::ERROR << "Image download from " << _http.getUrl() << " failed: " << _http.getError();
+        return false;
+    }
+    if (_http.isNotModified() && !_img.empty()) {
+        // server answered the conditional request: image is unchanged
+        rlog << log4cpp::Priority::INFO << "Image not modified";
+    } else if (_http.getStatus() == 200 && !_http.getBody().empty()) {
+        // decode image directly from the response body
+        const std::vector<unsigned char> & body = _http.getBody();
+        _img = cv::imdecode(cv::Mat(1, (int) body.size(), CV_8UC1, (void*) &body[0]), CV_LOAD_IMAGE_COLOR);
+        if (_img.empty()) {
+            rlog << log4cpp::Priority::ERROR << "Failed to decode image of " << body.size() << " bytes";
+            return false;
+        }
+    } else {
+        rlog << log4cpp::Priority::ERROR << "Image download failed with HTTP status " << _http.getStatus();
+        return false;
+    }
+    rlog << log4cpp::Priority::INFO << "Image captured: " << _http.getStatus();
 
     // save copy of image if requested
     if (!_outDir.empty()) {
@@ -140,3 +461,7 @@ bool URLInput::nextImage() {
 
     return true;
 }
+
+HttpClient & URLInput::getHttpClient() {
+    return _http;
+}
@@ -9,17 +9,24 @@
 #include <ctime>
 #include <string>
 #include <list>
+#include <set>
+#include <thread>
+#include <atomic>
 
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
 #include "Directory.h"
+#include "HttpClient.h"
+#include "FrameBuffer.h"
 
 class ImageInput {
 public:
+    ImageInput();
     virtual ~ImageInput();
 
     virtual bool nextImage() = 0;
+    bool isSkipped() const;
 
     virtual cv::Mat & getImage();
     virtual time_t getTime();
@@ -30,6 +37,7 @@ protected:
     cv::Mat _img;
     time_t _time;
     std::string _outDir;
+    bool _skipped;
 };
 
 class DirectoryInput: public ImageInput {
@@ -38,21 +46,63 @@ public:
 
     virtual bool nextImage();
 
-private:
+    static time_t parseTime(const std::string & filename);
+
+protected:
+    void readFile(const std::string & filename);
+
     Directory _directory;
     std::list<std::string>::const_iterator _itFilename;
     std::list<std::string> _filenameList;
 };
 
+class DirectoryWatchInput: public DirectoryInput {
+public:
+    DirectoryWatchInput(const Directory & directory);
+    virtual ~DirectoryWatchInput();
+
+    virtual bool nextImage();
+
+private:
+    bool waitForFiles();
+    bool prepareDoneDir();
+    void disposeFile(const std::string & filename);
+
+    int _inotifyFd;
+    std::set<std::string> _pending;
+    std::string _current;
+    // name of the newest file taken from _pending, files are processed in name order
+    std::string _lastTaken;
+    // target of spoolAction move
+    std::string _doneDir;
+    bool _started;
+    bool _usable;
+};
+
 class CameraInput: public ImageInput {
 public:
     CameraInput(int device);
     CameraInput(std::string url);
+    virtual ~CameraInput();
 
     virtual bool nextImage();
+    void captureThread(bool bval = true);
+
+    unsigned long getDroppedFrames() const;
+    long long getFrameAge() const;
 
 private:
+    void startCapture();
+    void stopCapture();
+    void captureLoop();
+
     cv::VideoCapture _capture;
+    FrameBuffer _buffer;
+    std::thread _thread;
+    std::atomic<bool> _stop;
+    std::atomic<bool> _failed;
+    bool _captureThread;
+    long long _frameAge;
 };
 
 class URLInput: public ImageInput {
@@ -61,8 +111,12 @@ public:
 
     virtual bool nextImage();
 
+    void startRequest();
+    bool decodeResponse();
+    HttpClient & getHttpClient();
+
 private:
-    std::string _urlImageSource;
+    HttpClient _http;
 };
 
 
@@ -5,6 +5,9 @@
 
 #include <vector>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
 
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -14,6 +17,7 @@
 
 #include "ImageProcessor.h"
 #include "Config.h"
+#include "Stats.h"
 
 /**
  * Functor to help sorting rectangles by their x-position.
@@ -25,14 +29,54 @@ public:
     }
 };
 
-ImageProcessor::ImageProcessor() :
-        _debugWindow(false), _debugSkew(false), _debugDigits(true), _debugEdges(false) {
+/**
+ * Region of interest of the counter from the config, clipped to the image.
+ * The whole image if no region is configured.
+ */
+static cv::Rect counterRoi(const Config & config, const cv::Size & size) {
+    cv::Rect full(0, 0, size.width, size.height);
+    if (config.getRoiWidth() <= 0 || config.getRoiHeight() <= 0) {
+        return full;
+    }
+    cv::Rect roi = cv::Rect(config.getRoiX(), config.getRoiY(), config.getRoiWidth(), config.getRoiHeight()) & full;
+    return roi.area() > 0 ? roi : full;
+}
+
+/**
+ * Skew tracking: search band and step of the projection profile in degrees,
+ * and the tolerated movement of the profile peak.
+ */
+static const float SKEW_BAND = 2.f;
+static const float SKEW_STEP = 0.25f;
+static const float SKEW_TOLERANCE = 0.5f;
+
+/**
+ * Projection profile skew engine: search range and steps of the coarse to
+ * fine search in degrees, and the scale of the edge image it works on.
+ */
+static const float SKEW_RANGE = 30.f;
+static const float SKEW_COARSE_STEP = 2.f;
+static const float SKEW_FINE_STEP = 0.25f;
+static const float SKEW_FINEST_STEP = 0.05f;
+static const double SKEW_PROFILE_SCALE = 0.5;
+static const size_t SKEW_MIN_POINTS = 50;
+
+/**
+ * Width of the thumbnail compared by the frame difference gate.
+ */
+static const int THUMB_WIDTH = 64;
+
+template<class Debug>
+ImageProcessorT<Debug>::ImageProcessorT(const Config & config) :
+        _config(config), _profileBins(0), _debugWindow(false), _debugSkew(false), _debugDigits(true), _debugEdges(false),
+        _skewTracking(true), _frameGating(false), _digitTracking(true), _skewValid(false), _skew(0.f), _skewRotation(0.f), _skewPeak(0.f), _skewAge(0) {
 }
 
 /**
  * Set the input image.
  */
-void ImageProcessor::setInput(cv::Mat & img) {
+template<class Debug>
+void ImageProcessorT<Debug>::setInput(const cv::Mat & img) {
     _img = img;
 }
 
@@ -40,97 +84,311 @@ void ImageProcessor::setInput(cv::Mat & img) {
  * Get the vector of output images.
  * Each image contains the edges of one isolated digit.
  */
-const std::vector<cv::Mat> & ImageProcessor::getOutput() {
+template<class Debug>
+const std::vector<cv::Mat> & ImageProcessorT<Debug>::getOutput() {
     return _digits;
 }
 
-void ImageProcessor::debugWindow(bool bval) {
+template<class Debug>
+void ImageProcessorT<Debug>::debugWindow(bool bval) {
     _debugWindow = bval;
-    if (_debugWindow) {
+    if (Debug::enabled && _debugWindow) {
         cv::namedWindow("ImageProcessor");
     }
 }
 
-void ImageProcessor::debugSkew(bool bval) {
+template<class Debug>
+void ImageProcessorT<Debug>::debugSkew(bool bval) {
     _debugSkew = bval;
 }
 
-void ImageProcessor::debugEdges(bool bval) {
+template<class Debug>
+void ImageProcessorT<Debug>::debugEdges(bool bval) {
     _debugEdges = bval;
 }
 
-void ImageProcessor::debugDigits(bool bval) {
+template<class Debug>
+void ImageProcessorT<Debug>::debugDigits(bool bval) {
     _debugDigits = bval;
 }
 
-void ImageProcessor::showImage() {
+/**
+ * Reuse the skew of previous frames (default) or search it in every frame.
+ */
+template<class Debug>
+void ImageProcessorT<Debug>::skewTracking(bool bval) {
+    _skewTracking = bval;
+    _skewValid = false;
+}
+
+/**
+ * Search the digits around the ones of the previous frame (default) or in the whole image.
+ */
+template<class Debug>
+void ImageProcessorT<Debug>::digitTracking(bool bval) {
+    _digitTracking = bval;
+    _trackedBoxes.clear();
+}
+
+template<class Debug>
+void ImageProcessorT<Debug>::showImage() {
+    if (!Debug::enabled) {
+        return;
+    }
     cv::imshow("ImageProcessor", _img);
     //cv::imshow("ImageProcessorFiltered", _imgGray);
     cv::imshow("ImageProcessorBW", _imgBW);
     cv::waitKey(1);
 }
 
+/**
+ * Skip frames whose counter window did not change since the last processed
+ * frame (off by default, needs frameDiffThreshold > 0).
+ */
+template<class Debug>
+void ImageProcessorT<Debug>::frameGating(bool bval) {
+    _frameGating = bval;
+    _thumbRef.release();
+}
+
 /**
  * Main processing function.
  * Read input image and create vector of images for each digit.
+ * Returns false if the frame was skipped by the frame difference gate,
+ * the output of the previous frame is still valid then.
  */
-void ImageProcessor::process() {
+template<class Debug>
+bool ImageProcessorT<Debug>::process() {
+    if (_frameGating && _config.getFrameDiffThreshold() > 0) {
+        bool changed;
+        {
+            StageTimer timer(Stats::GATE);
+            changed = frameChanged(_img(counterRoi(_config, _img.size())));
+        }
+        stats.countFrame(!changed);
+        if (!changed) {
+            return false;
+        }
+    }
+
     _digits.clear();
 
-	// Remove noise with Gaussian blur
-	cv::GaussianBlur(_img, _img, cv::Size(3, 3), 2, 2);
-	
-	// darken red colors
-	// Convert input image to HSV
-	cv::Mat hsv_image, bgr_image;
-	cvtColor(_img, hsv_image, CV_BGR2HSV);
-	// Threshold the HSV image, keep only the red pixels
-	cv::Mat lower_red_hue_range;
-	cv::Mat upper_red_hue_range;
-	cv::inRange(hsv_image, cv::Scalar(0, 60, 60), cv::Scalar(10, 255, 255), lower_red_hue_range);
-	cv::inRange(hsv_image, cv::Scalar(160, 60, 60), cv::Scalar(179, 255, 255), upper_red_hue_range);
-	// Combine the above two images
-	cv::Mat red_hue_image;
-	cv::addWeighted(lower_red_hue_range, 1.0, upper_red_hue_range, 1.0, 0.0, red_hue_image);
-	cv::GaussianBlur(red_hue_image, red_hue_image, cv::Size(3, 3), 2, 2);
-	// Mask original image
-	_img.copyTo(_imgFiltered);
-	cv::Mat black_image(_imgFiltered.size(), _imgFiltered.type(), cv::Scalar(7,7,7));  // all zeros image
-	black_image.copyTo(_imgFiltered, red_hue_image);
-	
-    // convert to gray
-    //cvtColor(_imgFiltered, _imgGray, CV_BGR2GRAY);
-	cvtColor(_img, _imgGray, CV_BGR2GRAY);
-
-    // initial rotation to get the digits up
-    rotate(config.getRotationDegrees());
-
-    // detect and correct remaining skew (+- 30 deg)
-    float skew_deg = detectSkew();
-    rotate(skew_deg);
-
-    // make BW image
-	threshold(_imgGray,_imgBW, config.getWhiteThreshold() /*threshold_value*/, 255, 0 /*threshold_type*/ );
-	
-    // find and isolate counter digits
-    findCounterDigits();
-
-    if (_debugWindow) {
+    detectEdges();
+
+    float skew_deg;
+    {
+        StageTimer timer(Stats::SKEW);
+        // detect remaining skew (+- 30 deg) relative to the initial rotation
+        skew_deg = trackSkew(_config.getRotationDegrees());
+    }
+
+    {
+        StageTimer timer(Stats::ROTATE);
+        // rotate the digits up and correct the skew with a single warp
+        rotate(_config.getRotationDegrees() + skew_deg);
+    }
+
+    {
+        StageTimer timer(Stats::DIGITS);
+        // make BW image
+        threshold(_imgGray, _imgBW, _config.getWhiteThreshold() /*threshold_value*/, 255, 0 /*threshold_type*/);
+
+        // find and isolate counter digits
+        findCounterDigits();
+    }
+
+    if (Debug::enabled && _debugWindow) {
         showImage();
     }
+    return true;
 }
 
 /**
- * Rotate image.
+ * Blur the counter window of the input image, convert it to gray and
+ * detect the edges. The input image is left untouched.
  */
-void ImageProcessor::rotate(double rotationDegrees) {
-    cv::Mat M = cv::getRotationMatrix2D(cv::Point(_imgGray.cols / 2, _imgGray.rows / 2), rotationDegrees, 1);
-    cv::Mat img_rotated;
-    cv::warpAffine(_imgGray, img_rotated, M, _imgGray.size());
-    _imgGray = img_rotated;
-    if (_debugWindow) {
-        cv::warpAffine(_img, img_rotated, M, _img.size());
-        _img = img_rotated;
+template<class Debug>
+void ImageProcessorT<Debug>::detectEdges() {
+    {
+        StageTimer timer(Stats::BLUR);
+        // Remove noise with Gaussian blur, restricted to the counter window.
+        cv::GaussianBlur(_img(counterRoi(_config, _img.size())), _imgBlurred, cv::Size(3, 3), 2, 2);
+        _img = _imgBlurred;
+    }
+
+    {
+        StageTimer timer(Stats::GRAY);
+        // convert to gray, optionally darken red colors
+        if (_config.getRedSuppression()) {
+            grayWithoutRed();
+        } else {
+            cvtColor(_img, _imgGray, CV_BGR2GRAY);
+        }
+    }
+
+    {
+        StageTimer timer(Stats::EDGES);
+        // edge image, used for skew detection and contour search
+        cv::Canny(_imgGray, _edges, _config.getCannyThreshold1(), _config.getCannyThreshold2());
+    }
+}
+
+/**
+ * Detect the skew of the edges found by detectEdges() with the given engine,
+ * "hough" or "profile", without the skew cache. Used by the benchmark.
+ */
+template<class Debug>
+bool ImageProcessorT<Debug>::measureSkew(const std::string & engine, float & skewDegrees) {
+    return detectSkew(_config.getRotationDegrees(), skewDegrees, engine);
+}
+
+/**
+ * Compare a small gray thumbnail of the counter window with the one of the
+ * last processed frame. The frame is unchanged if the mean absolute difference
+ * is below frameDiffThreshold gray levels. Comparing with the last processed
+ * frame instead of the previous one lets slow changes add up.
+ */
+template<class Debug>
+bool ImageProcessorT<Debug>::frameChanged(const cv::Mat & roi) {
+    if (roi.cols == 0 || roi.rows == 0) {
+        return true;
+    }
+    int width = std::min(roi.cols, THUMB_WIDTH);
+    int height = std::max(1, cvRound((double) roi.rows * width / roi.cols));
+    cv::resize(roi, _thumbColor, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+    cv::cvtColor(_thumbColor, _thumb, CV_BGR2GRAY);
+
+    bool changed = true;
+    if (_thumbRef.size() == _thumb.size()) {
+        cv::absdiff(_thumb, _thumbRef, _thumbDiff);
+        double diff = cv::mean(_thumbDiff)[0];
+        log4cpp::Category::getRoot().debug("frame difference: %.2f", diff);
+        changed = diff >= _config.getFrameDiffThreshold();
+    }
+    if (changed) {
+        cv::swap(_thumb, _thumbRef);
+    }
+    return changed;
+}
+
+/**
+ * Fixed point division tables of cvtColor(CV_BGR2HSV) for 8 bit images.
+ */
+struct HsvTables {
+    int sdiv[256];
+    int hdiv[256];
+
+    HsvTables() {
+        sdiv[0] = hdiv[0] = 0;
+        for (int i = 1; i < 256; i++) {
+            sdiv[i] = cvRound((255 << 12) / (1. * i));
+            hdiv[i] = cvRound((180 << 12) / (6. * i));
+        }
+    }
+};
+
+static const HsvTables hsvTables;
+
+/**
+ * Test if a BGR pixel is red: HSV hue 0..10 or 160..179, saturation and value >= 60.
+ * Same integer arithmetic as cvtColor(CV_BGR2HSV) followed by cv::inRange().
+ */
+static inline bool isRed(int b, int g, int r) {
+    int v = std::max(r, std::max(g, b));
+    if (v < 60) {
+        return false;
+    }
+    int diff = v - std::min(r, std::min(g, b));
+    int s = (diff * hsvTables.sdiv[v] + (1 << 11)) >> 12;
+    if (s < 60) {
+        return false;
+    }
+    int h;
+    if (v == r) {
+        h = g - b;
+    } else if (v == g) {
+        h = b - r + 2 * diff;
+    } else {
+        h = r - g + 4 * diff;
+    }
+    h = (h * hsvTables.hdiv[diff] + (1 << 11)) >> 12;
+    if (h < 0) {
+        h += 180;
+    }
+    return h <= 10 || (h >= 160 && h <= 179);
+}
+
+/**
+ * Convert the image to gray and darken red areas in a single pass.
+ * Red pixels and their 8 neighbours get the gray value 7, which is what the
+ * blurred red hue mask did before. Only a rolling mask of three rows is kept.
+ */
+template<class Debug>
+void ImageProcessorT<Debug>::grayWithoutRed() {
+    const int rows = _img.rows;
+    const int cols = _img.cols;
+    _imgGray.create(rows, cols, CV_8UC1);
+    // mask rows with a border of one pixel on each side
+    _redMask.create(3, cols + 2, CV_8UC1);
+    _redMask = cv::Scalar(0);
+
+    for (int y = 0; y <= rows; ++y) {
+        uchar* mask = _redMask.ptr<uchar>(y % 3) + 1;
+        if (y < rows) {
+            const uchar* src = _img.ptr<uchar>(y);
+            uchar* gray = _imgGray.ptr<uchar>(y);
+            for (int x = 0; x < cols; ++x, src += 3) {
+                gray[x] = (uchar) ((src[0] * 1868 + src[1] * 9617 + src[2] * 4899 + (1 << 13)) >> 14);
+                mask[x] = isRed(src[0], src[1], src[2]);
+            }
+        } else {
+            memset(mask, 0, cols);
+        }
+        if (y == 0) {
+            continue;
+        }
+        // row y-1 is complete: darken it where a red pixel is in its 3x3 neighbourhood
+        // (the mask row of y-2 is still empty for y == 1)
+        const uchar* m0 = _redMask.ptr<uchar>((y + 1) % 3) + 1;
+        const uchar* m1 = _redMask.ptr<uchar>((y + 2) % 3) + 1;
+        const uchar* m2 = mask;
+        uchar* gray = _imgGray.ptr<uchar>(y - 1);
+        for (int x = 0; x < cols; ++x) {
+            if (m0[x - 1] | m0[x] | m0[x + 1] | m1[x - 1] | m1[x] | m1[x + 1] | m2[x - 1] | m2[x] | m2[x + 1]) {
+                gray[x] = 7;
+            }
+        }
+    }
+}
+
+/**
+ * Rotate gray image and edge image.
+ * The edge image is rotated with nearest neighbour interpolation instead of
+ * running the edge detection again on the rotated image.
+ * The images are warped into second buffers which are then swapped in, so no
+ * memory is allocated as long as the image size does not change.
+ */
+template<class Debug>
+void ImageProcessorT<Debug>::rotate(double rotationDegrees) {
+    if (std::fabs(rotationDegrees) < 1e-3) {
+        return;
+    }
+    // same matrix as cv::getRotationMatrix2D(), without allocating a Mat
+    double angle = rotationDegrees * CV_PI / 180.;
+    double alpha = std::cos(angle);
+    double beta = std::sin(angle);
+    double cx = _imgGray.cols / 2;
+    double cy = _imgGray.rows / 2;
+    cv::Matx23d M(alpha, beta, (1 - alpha) * cx - beta * cy,
+            -beta, alpha, beta * cx + (1 - alpha) * cy);
+
+    cv::warpAffine(_imgGray, _imgGrayRotated, M, _imgGray.size());
+    cv::swap(_imgGray, _imgGrayRotated);
+    cv::warpAffine(_edges, _edgesRotated, M, _edges.size(), cv::INTER_NEAREST);
+    cv::swap(_edges, _edgesRotated);
+    if (Debug::enabled && _debugWindow) {
+        cv::warpAffine(_img, _imgRotated, M, _img.size());
+        _img = _imgRotated;
     }
 }
 
@@ -138,7 +396,8 @@ void ImageProcessor::rotate(double rotationDegrees) {
  * Draw lines into image.
  * For debugging purposes.
  */
-void ImageProcessor::drawLines(std::vector<cv::Vec2f>& lines) {
+template<class Debug>
+void ImageProcessorT<Debug>::drawLines(std::vector<cv::Vec2f>& lines) {
     // draw lines
     for (size_t i = 0; i < lines.size(); i++) {
         float rho = lines[i][0];
@@ -155,7 +414,8 @@ void ImageProcessor::drawLines(std::vector<cv::Vec2f>& lines) {
  * Draw lines into image.
  * For debugging purposes.
  */
-void ImageProcessor::drawLines(std::vector<cv::Vec4i>& lines, int xoff, int yoff) {
+template<class Debug>
+void ImageProcessorT<Debug>::drawLines(std::vector<cv::Vec4i>& lines, int xoff, int yoff) {
     for (size_t i = 0; i < lines.size(); i++) {
         cv::line(_img, cv::Point(lines[i][0] + xoff, lines[i][1] + yoff),
                 cv::Point(lines[i][2] + xoff, lines[i][3] + yoff), cv::Scalar(255, 0, 0), 1);
@@ -163,25 +423,181 @@ void ImageProcessor::drawLines(std::vector<cv::Vec4i>& lines, int xoff, int yoff
 }
 
 /**
- * Detect the skew of the image by finding almost (+- 30 deg) horizontal lines.
+ * Get the skew of the current frame.
+ * The skew found by the last full search is reused as long as the projection
+ * profile of the edges confirms that the image did not turn. A full search runs
+ * on the first frame, every skewRecheckInterval frames, if the validation fails
+ * and after the digit alignment degraded.
+ */
+template<class Debug>
+float ImageProcessorT<Debug>::trackSkew(float rotationDegrees) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    int interval = _config.getSkewRecheckInterval();
+    bool tracking = _skewTracking && interval > 0;
+
+    if (tracking && _skewValid && _skewAge < interval && _skewRotation == rotationDegrees) {
+        float peak = profilePeak(rotationDegrees + _skew);
+        if (std::fabs(peak - _skewPeak) <= SKEW_TOLERANCE) {
+            ++_skewAge;
+            rlog.info("skew: %.1f deg (cache)", _skew);
+            return _skew;
+        }
+        rlog.info("skew cache invalid: profile peak moved by %.2f deg", peak - _skewPeak);
+    }
+
+    _skewValid = detectSkew(rotationDegrees, _skew, _config.getSkewEngine());
+    _skewRotation = rotationDegrees;
+    _skewAge = 0;
+    if (tracking && _skewValid) {
+        _skewPeak = profilePeak(rotationDegrees + _skew);
+    }
+    rlog.info("skew: %.1f deg (full search)", _skew);
+    return _skew;
+}
+
+/**
+ * Find the angle offset within +- SKEW_BAND around the given rotation at which
+ * the horizontal projection profile of the edge image is sharpest.
+ */
+template<class Debug>
+float ImageProcessorT<Debug>::profilePeak(float rotationDegrees) {
+    collectEdgePoints(_edges);
+    return profileSearch(rotationDegrees - SKEW_BAND, rotationDegrees + SKEW_BAND, SKEW_STEP) - rotationDegrees;
+}
+
+/**
+ * Collect the edge points relative to the image center. x and y are kept in
+ * separate arrays, so that the rotation in profileScore() vectorizes.
+ */
+template<class Debug>
+void ImageProcessorT<Debug>::collectEdgePoints(const cv::Mat & edges) {
+    _edgePoints.clear();
+    cv::findNonZero(edges, _edgePoints);
+
+    float cx = edges.cols / 2;
+    float cy = edges.rows / 2;
+    _pointsX.resize(_edgePoints.size());
+    _pointsY.resize(_edgePoints.size());
+    for (size_t i = 0; i < _edgePoints.size(); ++i) {
+        _pointsX[i] = _edgePoints[i].x - cx;
+        _pointsY[i] = _edgePoints[i].y - cy;
+    }
+    _profileBins = cvCeil(std::sqrt((double) edges.cols * edges.cols + (double) edges.rows * edges.rows)) + 2;
+}
+
+/**
+ * Sharpness of the horizontal projection profile of the edge points in the
+ * image rotated by the angle: the sum of the squared row counts.
+ */
+template<class Debug>
+long long ImageProcessorT<Debug>::profileScore(float angleDegrees) {
+    double a = angleDegrees * CV_PI / 180.;
+    const float sa = std::sin(a);
+    const float ca = std::cos(a);
+    // shifted by half the bins, so that truncation rounds
+    const float offset = _profileBins / 2 + 0.5f;
+    const size_t n = _pointsX.size();
+    const float* px = n ? &_pointsX[0] : 0;
+    const float* py = n ? &_pointsY[0] : 0;
+    _profileRows.resize(n);
+    int* rows = n ? &_profileRows[0] : 0;
+    for (size_t i = 0; i < n; ++i) {
+        // y coordinate of the point in the rotated image
+        rows[i] = (int) (-sa * px[i] + ca * py[i] + offset);
+    }
+    _profile.assign(_profileBins, 0);
+    for (size_t i = 0; i < n; ++i) {
+        ++_profile[rows[i]];
+    }
+    long long score = 0;
+    for (int i = 0; i < _profileBins; ++i) {
+        score += (long long) _profile[i] * _profile[i];
+    }
+    return score;
+}
+
+/**
+ * Angle between from and to with the sharpest projection profile of the
+ * collected edge points. Of equal scores the first angle is taken.
+ */
+template<class Debug>
+float ImageProcessorT<Debug>::profileSearch(float from, float to, float step) {
+    float bestAngle = from;
+    long long bestScore = -1;
+    for (int i = 0; from + i * step <= to + 1e-3f; ++i) {
+        float angle = from + i * step;
+        long long score = profileScore(angle);
+        if (score > bestScore) {
+            bestScore = score;
+            bestAngle = angle;
+        }
+    }
+    return bestAngle;
+}
+
+/**
+ * Detect the skew (+- 30 deg) relative to the given rotation with the selected engine.
+ * Returns false if no skew was found, the skew is 0 then.
  */
-float ImageProcessor::detectSkew() {
+template<class Debug>
+bool ImageProcessorT<Debug>::detectSkew(float rotationDegrees, float & skewDegrees, const std::string & engine) {
+    if (engine == "profile") {
+        return detectSkewProfile(rotationDegrees, skewDegrees);
+    }
+    return detectSkewHough(rotationDegrees, skewDegrees);
+}
+
+/**
+ * Detect the skew by maximizing the sharpness of the horizontal projection
+ * profile of the edges, coarse to fine on an edge image of half the size.
+ * Works on low-contrast images where no long straight line is found.
+ */
+template<class Debug>
+bool ImageProcessorT<Debug>::detectSkewProfile(float rotationDegrees, float & skewDegrees) {
     log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    skewDegrees = 0.f;
 
-    cv::Mat edges = cannyEdges();
+    cv::resize(_edges, _edgesSmall, cv::Size(), SKEW_PROFILE_SCALE, SKEW_PROFILE_SCALE, cv::INTER_AREA);
+    collectEdgePoints(_edgesSmall);
+    if (_pointsX.size() < SKEW_MIN_POINTS) {
+        rlog.warn("failed to detect skew: %d edge points", (int) _pointsX.size());
+        return false;
+    }
+
+    float angle = profileSearch(rotationDegrees - SKEW_RANGE, rotationDegrees + SKEW_RANGE, SKEW_COARSE_STEP);
+    angle = profileSearch(angle - SKEW_COARSE_STEP, angle + SKEW_COARSE_STEP, SKEW_FINE_STEP);
+    angle = profileSearch(angle - SKEW_FINE_STEP, angle + SKEW_FINE_STEP, SKEW_FINEST_STEP);
+    skewDegrees = angle - rotationDegrees;
+    rlog.info("detectSkew (profile): %.1f deg", skewDegrees);
+    return true;
+}
+
+/**
+ * Detect the skew of the image by finding almost (+- 30 deg) horizontal lines.
+ * The lines are searched in the unrotated edge image, their angles are taken
+ * relative to the given rotation of the image.
+ * Returns false if no line was found, the skew is 0 then.
+ */
+template<class Debug>
+bool ImageProcessorT<Debug>::detectSkewHough(float rotationDegrees, float & skewDegrees) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
 
     // find lines
-    std::vector<cv::Vec2f> lines;
-    cv::HoughLines(edges, lines, 1, CV_PI / 180.f, 140);
+    std::vector<cv::Vec2f>& lines = _lines;
+    cv::HoughLines(_edges, lines, 1, CV_PI / 180.f, 140);
 
     // filter lines by theta and compute average
-    std::vector<cv::Vec2f> filteredLines;
+    std::vector<cv::Vec2f>& filteredLines = _filteredLines;
+    filteredLines.clear();
     float theta_min = 60.f * CV_PI / 180.f;
     float theta_max = 120.f * CV_PI / 180.0f;
     float theta_avr = 0.f;
     float theta_deg = 0.f;
+    float rotation = rotationDegrees * CV_PI / 180.f;
     for (size_t i = 0; i < lines.size(); i++) {
-        float theta = lines[i][1];
+        // angle of the line in the rotated image
+        float theta = lines[i][1] - rotation;
+        theta -= std::floor(theta / CV_PI) * CV_PI;
         if (theta >= theta_min && theta <= theta_max) {
             filteredLines.push_back(lines[i]);
             theta_avr += theta;
@@ -195,52 +611,117 @@ float ImageProcessor::detectSkew() {
         rlog.warn("failed to detect skew");
     }
 
-    if (_debugSkew) {
+    if (Debug::enabled && _debugSkew) {
         drawLines(filteredLines);
     }
 
-    return theta_deg;
+    skewDegrees = theta_deg;
+    return filteredLines.size() > 0;
 }
 
 /**
- * Detect edges using Canny algorithm.
+ * Add delta at (y, height) to the 2D Fenwick tree used by findAlignedBoxes().
  */
-cv::Mat ImageProcessor::cannyEdges() {
-    cv::Mat edges;
-    // detect edges
-    cv::Canny(_imgGray, edges, config.getCannyThreshold1(), config.getCannyThreshold2());
-    return edges;
+static void alignTreeUpdate(std::vector<int>& tree, int rows, int cols, int y, int height, int delta) {
+    for (int i = y + 1; i <= rows; i += i & -i) {
+        for (int j = height + 1; j <= cols; j += j & -j) {
+            tree[(i - 1) * cols + j - 1] += delta;
+        }
+    }
 }
 
 /**
- * Find bounding boxes that are aligned at y position.
+ * Number of boxes in the tree with y <= maxY and height <= maxHeight.
  */
-void ImageProcessor::findAlignedBoxes(std::vector<cv::Rect>::const_iterator begin,
-        std::vector<cv::Rect>::const_iterator end, std::vector<cv::Rect>& result) {
-    std::vector<cv::Rect>::const_iterator it = begin;
-    cv::Rect start = *it;
-    ++it;
-    result.push_back(start);
+static int alignTreePrefix(const std::vector<int>& tree, int rows, int cols, int maxY, int maxHeight) {
+    if (maxY < 0 || maxHeight < 0) {
+        return 0;
+    }
+    maxY = std::min(maxY, rows - 1);
+    maxHeight = std::min(maxHeight, cols - 1);
+    int count = 0;
+    for (int i = maxY + 1; i > 0; i -= i & -i) {
+        for (int j = maxHeight + 1; j > 0; j -= j & -j) {
+            count += tree[(i - 1) * cols + j - 1];
+        }
+    }
+    return count;
+}
+
+/**
+ * Find the largest group of bounding boxes that are aligned at y position.
+ * A group starts with one box and contains all following boxes whose y position
+ * differs by less than digitYAlignment and whose height differs by less than
+ * digitYAlignment/2. Of groups with equal size the first one is taken.
+ * The group sizes are counted by inserting the boxes from back to front into a
+ * 2D Fenwick tree over (y, height), which is O(n log(y) log(height)).
+ */
+template<class Debug>
+void ImageProcessorT<Debug>::findAlignedBoxes(const std::vector<cv::Rect>& boxes, std::vector<cv::Rect>& result) {
+    result.clear();
+    if (boxes.empty()) {
+        return;
+    }
+    const int yAlignment = _config.getDigitYAlignment();
+    const int heightAlignment = yAlignment / 2;
 
-    for (; it != end; ++it) {
-        if (abs(start.y - it->y) < config.getDigitYAlignment() && abs(start.height - it->height) < config.getDigitYAlignment()/2) {
-            result.push_back(*it);
+    int rows = 1, cols = 1;
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        rows = std::max(rows, boxes[i].y + 1);
+        cols = std::max(cols, boxes[i].height + 1);
+    }
+    // the tree is all zero between calls, only its layout changes
+    if (_alignTree.size() < (size_t) rows * cols) {
+        _alignTree.resize((size_t) rows * cols, 0);
+    }
+
+    int bestCount = 0;
+    int bestIndex = 0;
+    for (int i = (int) boxes.size() - 1; i >= 0; --i) {
+        int y1 = boxes[i].y - yAlignment + 1, y2 = boxes[i].y + yAlignment - 1;
+        int h1 = boxes[i].height - heightAlignment + 1, h2 = boxes[i].height + heightAlignment - 1;
+        int count = 1;
+        if (y1 <= y2 && h1 <= h2) {
+            count += alignTreePrefix(_alignTree, rows, cols, y2, h2) - alignTreePrefix(_alignTree, rows, cols, y1 - 1, h2)
+                    - alignTreePrefix(_alignTree, rows, cols, y2, h1 - 1) + alignTreePrefix(_alignTree, rows, cols, y1 - 1, h1 - 1);
+        }
+        if (count >= bestCount) {
+            bestCount = count;
+            bestIndex = i;
+        }
+        alignTreeUpdate(_alignTree, rows, cols, boxes[i].y, boxes[i].height, 1);
+    }
+    for (size_t i = 0; i < boxes.size(); ++i) {
+        alignTreeUpdate(_alignTree, rows, cols, boxes[i].y, boxes[i].height, -1);
+    }
+
+    // collect the members of the largest group
+    const cv::Rect & start = boxes[bestIndex];
+    result.reserve(bestCount);
+    result.push_back(start);
+    for (size_t i = bestIndex + 1; i < boxes.size(); ++i) {
+        if (abs(start.y - boxes[i].y) < yAlignment && abs(start.height - boxes[i].height) < heightAlignment) {
+            result.push_back(boxes[i]);
         }
     }
 }
 
 /**
  * Filter contours by size of bounding rectangle.
+ * The indices of the accepted contours are returned instead of copies.
  */
-void ImageProcessor::filterContours(std::vector<std::vector<cv::Point> >& contours,
-        std::vector<cv::Rect>& boundingBoxes, std::vector<std::vector<cv::Point> >& filteredContours) {
+template<class Debug>
+void ImageProcessorT<Debug>::filterContours(std::vector<std::vector<cv::Point> >& contours,
+        std::vector<cv::Rect>& boundingBoxes, std::vector<int>& filteredContours) {
+    boundingBoxes.clear();
+    filteredContours.clear();
     // filter contours by bounding rect size
     for (size_t i = 0; i < contours.size(); i++) {
         cv::Rect bounds = cv::boundingRect(contours[i]);
-        if (bounds.height > config.getDigitMinHeight() && bounds.height < config.getDigitMaxHeight()
+        if (bounds.height > _config.getDigitMinHeight() && bounds.height < _config.getDigitMaxHeight()
                 && bounds.width > (bounds.height/4 ) && bounds.width < bounds.height) {
             boundingBoxes.push_back(bounds);
-            filteredContours.push_back(contours[i]);
+            filteredContours.push_back(i);
         }
     }
 }
@@ -248,55 +729,46 @@ void ImageProcessor::filterContours(std::vector<std::vector<cv::Point> >& contou
 /**
  * Find and isolate the digits of the counter,
  */
-void ImageProcessor::findCounterDigits() {
+template<class Debug>
+void ImageProcessorT<Debug>::findCounterDigits() {
     log4cpp::Category& rlog = log4cpp::Category::getRoot();
 
     // edge image
-    cv::Mat edges = cannyEdges();
-    if (_debugEdges) {
-        cv::imshow("edges", edges);
+    if (Debug::enabled && _debugEdges) {
+        cv::imshow("edges", _edges);
     }
 
-    cv::Mat img_ret = edges.clone();
-
-    // find contours in whole image
-    std::vector<std::vector<cv::Point> > contours, filteredContours;
-    std::vector<cv::Rect> boundingBoxes;
-    cv::findContours(edges, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
-
-    // filter contours by bounding rect size
-    filterContours(contours, boundingBoxes, filteredContours);
-
-    rlog << log4cpp::Priority::INFO << "number of filtered contours: " << filteredContours.size();
-
-    // find bounding boxes that are aligned at y position
-    std::vector<cv::Rect> alignedBoundingBoxes, tmpRes;
-    for (std::vector<cv::Rect>::const_iterator ib = boundingBoxes.begin(); ib != boundingBoxes.end(); ++ib) {
-        tmpRes.clear();
-        findAlignedBoxes(ib, boundingBoxes.end(), tmpRes);
-        if (tmpRes.size() > alignedBoundingBoxes.size()) {
-            alignedBoundingBoxes = tmpRes;
+    // search around the digits of the last frame first
+    bool tracked = false;
+    if (_digitTracking && !_trackedBoxes.empty()) {
+        findDigitBoxes(trackingBand());
+        tracked = trackedLayoutValid();
+        if (!tracked) {
+            rlog.info("digit tracking lost, full search");
         }
     }
+    if (!tracked) {
+        findDigitBoxes(cv::Rect(0, 0, _edges.cols, _edges.rows));
+    }
 
-    // sort bounding boxes from left to right
-    std::sort(alignedBoundingBoxes.begin(), alignedBoundingBoxes.end(), sortRectByX());
-	std::vector<cv::Rect> okBoundingBoxes;
-	int prevX = 0;
-    for (int i = 0; i < alignedBoundingBoxes.size(); ++i) {
-		// Csak akkor, ha nincs átfedés
-		if (alignedBoundingBoxes[i].x > prevX+config.getDigitMinHeight()/2) {
-			okBoundingBoxes.push_back(alignedBoundingBoxes[i]);
-			prevX = alignedBoundingBoxes[i].x;
-		}
+	std::vector<cv::Rect>& okBoundingBoxes = _digitBoxes;
+    rlog.info("max number of alignedBoxes: %d (%s)", (int) okBoundingBoxes.size(),
+            tracked ? "tracked" : "full search");
+    if (okBoundingBoxes.size() < (size_t) _config.getMeterValueLength()) {
+        // digit alignment degraded: search the skew and the digits again in the next frame
+        _skewValid = false;
+        _trackedBoxes.clear();
+    } else {
+        _trackedBoxes = okBoundingBoxes;
     }
-    rlog << log4cpp::Priority::INFO << "max number of alignedBoxes: " << okBoundingBoxes.size();
 
-    if (_debugEdges) {
+    if (Debug::enabled && _debugEdges) {
         // draw contours
-        cv::Mat cont = cv::Mat::zeros(edges.rows, edges.cols, CV_8UC1);
+        cv::Mat cont = cv::Mat::zeros(_edges.rows, _edges.cols, CV_8UC1);
         //cv::drawContours(cont, okBoundingBoxes /*filteredContours*/, -1, cv::Scalar(255));
-		cv::drawContours(cont, filteredContours, -1, cv::Scalar(255));
+		for (size_t i = 0; i < _filteredContours.size(); ++i) {
+			cv::drawContours(cont, _contours, _filteredContours[i], cv::Scalar(255));
+		}
         cv::imshow("contours", cont);
     }
 
@@ -304,8 +776,97 @@ void ImageProcessor::findCounterDigits() {
     for (int i = 0; i < okBoundingBoxes.size(); ++i) {
 	cv::Rect roi = okBoundingBoxes[i];
 		_digits.push_back(_imgBW(roi));
-		if (_debugDigits) {
+		if (Debug::enabled && _debugDigits) {
 			cv::rectangle(_img, roi, cv::Scalar(0, 255, 0), 2);
 		}
     }
 }
+
+/**
+ * Area around the digits of the last frame, with a margin for small movements.
+ */
+template<class Debug>
+cv::Rect ImageProcessorT<Debug>::trackingBand() {
+    cv::Rect band = _trackedBoxes[0];
+    for (size_t i = 1; i < _trackedBoxes.size(); ++i) {
+        band |= _trackedBoxes[i];
+    }
+    int margin = std::max(_config.getDigitYAlignment(), band.height / 4);
+    band = cv::Rect(band.x - margin, band.y - margin, band.width + 2 * margin, band.height + 2 * margin);
+    return band & cv::Rect(0, 0, _edges.cols, _edges.rows);
+}
+
+/**
+ * The digits found in the tracking band are valid if they are the same number
+ * as in the last frame and each one stayed in place within digitYAlignment.
+ */
+template<class Debug>
+bool ImageProcessorT<Debug>::trackedLayoutValid() {
+    if (_digitBoxes.size() != _trackedBoxes.size()) {
+        return false;
+    }
+    int tolerance = _config.getDigitYAlignment();
+    for (size_t i = 0; i < _digitBoxes.size(); ++i) {
+        const cv::Rect & box = _digitBoxes[i];
+        const cv::Rect & last = _trackedBoxes[i];
+        if (abs(box.x - last.x) >= tolerance || abs(box.y - last.y) >= tolerance
+                || abs(box.height - last.height) >= tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Find the digit boxes within the area of the edge image.
+ * Only the bounding boxes are needed, so the contours are kept with
+ * CV_CHAIN_APPROX_SIMPLE, which results in the same boxes as the full point lists.
+ */
+template<class Debug>
+void ImageProcessorT<Debug>::findDigitBoxes(const cv::Rect & area) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+
+    // find contours
+    // (the vectors are members, so their storage is reused from frame to frame)
+    std::vector<std::vector<cv::Point> >& contours = _contours;
+    std::vector<int>& filteredContours = _filteredContours;
+    std::vector<cv::Rect>& boundingBoxes = _boundingBoxes;
+    if (area.width == _edges.cols && area.height == _edges.rows) {
+        cv::findContours(_edges, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+    } else {
+        // findContours modifies its input: keep the edge image for a full search.
+        // The band is a part of a buffer of the full size, which is not
+        // reallocated when the band changes its size from frame to frame.
+        _edgesBandBuffer.create(_edges.size(), _edges.type());
+        _edgesBand = _edgesBandBuffer(cv::Rect(0, 0, area.width, area.height));
+        _edges(area).copyTo(_edgesBand);
+        cv::findContours(_edgesBand, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE, area.tl());
+    }
+
+    // filter contours by bounding rect size
+    filterContours(contours, boundingBoxes, filteredContours);
+
+    rlog.info("number of filtered contours: %d", (int) filteredContours.size());
+
+    // find bounding boxes that are aligned at y position
+    std::vector<cv::Rect>& alignedBoundingBoxes = _alignedBoxes;
+    findAlignedBoxes(boundingBoxes, alignedBoundingBoxes);
+
+    // sort bounding boxes from left to right
+    std::sort(alignedBoundingBoxes.begin(), alignedBoundingBoxes.end(), sortRectByX());
+	std::vector<cv::Rect>& okBoundingBoxes = _digitBoxes;
+	okBoundingBoxes.clear();
+	int prevX = 0;
+    for (int i = 0; i < alignedBoundingBoxes.size(); ++i) {
+		// Csak akkor, ha nincs átfedés
+		if (alignedBoundingBoxes[i].x > prevX+_config.getDigitMinHeight()/2) {
+			okBoundingBoxes.push_back(alignedBoundingBoxes[i]);
+			prevX = alignedBoundingBoxes[i].x;
+		}
+    }
+}
+
+template class ImageProcessorT<NoDebug>;
+#ifndef HEADLESS
+template class ImageProcessorT<GuiDebug>;
+#endif
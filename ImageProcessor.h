@@ -7,49 +7,127 @@
 #define IMAGEPROCESSOR_H_
 
 #include <vector>
+#include <string>
 
 #include <opencv2/imgproc/imgproc.hpp>
 
 #include "ImageInput.h"
+#include "Config.h"
 
-class ImageProcessor {
+/**
+ * Debug policies of the image processor.
+ * With NoDebug all debug windows and drawing are compiled out of the
+ * processing path, which is what the writing modes use.
+ */
+struct NoDebug {
+    static const bool enabled = false;
+};
+
+struct GuiDebug {
+    static const bool enabled = true;
+};
+
+template<class Debug>
+class ImageProcessorT {
 public:
-    ImageProcessor();
+    ImageProcessorT(const Config & config = ::config);
 
     void setOrientation(int rotationDegrees);
-    void setInput(cv::Mat & img);
-    void process();
+    void setInput(const cv::Mat & img);
+    bool process();
+    void detectEdges();
+    bool measureSkew(const std::string & engine, float & skewDegrees);
     const std::vector<cv::Mat> & getOutput();
 
     void debugWindow(bool bval = true);
     void debugSkew(bool bval = true);
     void debugEdges(bool bval = true);
     void debugDigits(bool bval = true);
+    void skewTracking(bool bval = true);
+    void digitTracking(bool bval = true);
+    void frameGating(bool bval = true);
     void showImage();
     //void saveConfig();
     //void loadConfig();
 
 private:
+    bool frameChanged(const cv::Mat & roi);
+    void grayWithoutRed();
     void rotate(double rotationDegrees);
     void findCounterDigits();
-    void findAlignedBoxes(std::vector<cv::Rect>::const_iterator begin,
-            std::vector<cv::Rect>::const_iterator end, std::vector<cv::Rect>& result);
-    float detectSkew();
+    void findDigitBoxes(const cv::Rect & area);
+    cv::Rect trackingBand();
+    bool trackedLayoutValid();
+    void findAlignedBoxes(const std::vector<cv::Rect>& boxes, std::vector<cv::Rect>& result);
+    float trackSkew(float rotationDegrees);
+    float profilePeak(float rotationDegrees);
+    void collectEdgePoints(const cv::Mat & edges);
+    long long profileScore(float angleDegrees);
+    float profileSearch(float from, float to, float step);
+    bool detectSkew(float rotationDegrees, float & skewDegrees, const std::string & engine);
+    bool detectSkewProfile(float rotationDegrees, float & skewDegrees);
+    bool detectSkewHough(float rotationDegrees, float & skewDegrees);
     void drawLines(std::vector<cv::Vec2f>& lines);
     void drawLines(std::vector<cv::Vec4i>& lines, int xoff=0, int yoff=0);
-    cv::Mat cannyEdges();
     void filterContours(std::vector<std::vector<cv::Point> >& contours, std::vector<cv::Rect>& boundingBoxes,
-            std::vector<std::vector<cv::Point> >& filteredContours);
+            std::vector<int>& filteredContours);
 
+    const Config & _config;
     cv::Mat _img;
+    cv::Mat _imgBlurred;
+    cv::Mat _imgRotated;
     cv::Mat _imgGray;
+    cv::Mat _imgGrayRotated;
     cv::Mat _imgBW;
-    cv::Mat _imgFiltered;
+    cv::Mat _edges;
+    cv::Mat _edgesRotated;
+    cv::Mat _edgesSmall;
+    cv::Mat _edgesBand;
+    cv::Mat _edgesBandBuffer;
+    cv::Mat _redMask;
+    cv::Mat _thumbColor;
+    cv::Mat _thumb;
+    cv::Mat _thumbRef;
+    cv::Mat _thumbDiff;
     std::vector<cv::Mat> _digits;
+    // working storage, kept to avoid allocations in every frame
+    std::vector<std::vector<cv::Point> > _contours;
+    std::vector<int> _filteredContours;
+    std::vector<cv::Rect> _boundingBoxes;
+    std::vector<cv::Rect> _alignedBoxes;
+    std::vector<cv::Rect> _digitBoxes;
+    std::vector<cv::Rect> _trackedBoxes;
+    std::vector<cv::Vec2f> _lines;
+    std::vector<cv::Vec2f> _filteredLines;
+    std::vector<cv::Point> _edgePoints;
+    std::vector<float> _pointsX;
+    std::vector<float> _pointsY;
+    std::vector<int> _profileRows;
+    std::vector<int> _profile;
+    int _profileBins;
+    std::vector<int> _alignTree;
     bool _debugWindow;
     bool _debugSkew;
     bool _debugEdges;
     bool _debugDigits;
+    bool _skewTracking;
+    bool _frameGating;
+    bool _digitTracking;
+    bool _skewValid;
+    float _skew;
+    float _skewRotation;
+    float _skewPeak;
+    int _skewAge;
 };
 
+/**
+ * Image processor of the interactive modes, debug output can be switched on at runtime.
+ */
+typedef ImageProcessorT<GuiDebug> ImageProcessor;
+
+/**
+ * Image processor without any debug output.
+ */
+typedef ImageProcessorT<NoDebug> HeadlessImageProcessor;
+
 #endif /* IMAGEPROCESSOR_H_ */
@@ -5,23 +5,22 @@
  *
  */
 
-#include <opencv2/highgui/highgui.hpp>
-#include <opencv2/imgproc/imgproc.hpp>
-#include <opencv2/features2d/features2d.hpp>
 #include <opencv2/ml/ml.hpp>
 
 #include <log4cpp/Category.hh>
 #include <log4cpp/Priority.hh>
 
 #include <exception>
+#include <algorithm>
+#include <cfloat>
 
 #include "Config.h"
 
 #include "KNearestOcr.h"
 
 
-KNearestOcr::KNearestOcr() :
-        _pModel(0) {
+KNearestOcr::KNearestOcr(const Config & config) :
+        Ocr(config), _pModel(0), _useIndex(false) {
 }
 
 KNearestOcr::~KNearestOcr() {
@@ -31,122 +30,125 @@ KNearestOcr::~KNearestOcr() {
 }
 
 /**
- * Learn a single digit.
+ * Recognize all rows of samples, prepared with prepareSample(), in one pass
+ * over the model. Returns one character per row, '?' if it was rejected.
  */
-int KNearestOcr::learn(const cv::Mat & img) {
-
-	int key = 0;
-	int rec = recognize(img);
-	if (rec != '?') {
-		key = rec;
-	} else {
-        cv::imshow("Learn", img);
-		std::cout << "Enter number:" << std::endl;
-        key = (cv::waitKey(0))%256;
-        if (key >= '0' && key <= '9') {
-            _responses.push_back(cv::Mat(1, 1, CV_32F, (float) key - '0'));
-            _samples.push_back(prepareSample(img));
-			initModel(); // Add new data to recognize()
-		}
-    }
-
-    return key;
-}
-
-/**
- * Learn a vector of digits.
- */
-int KNearestOcr::learn(const std::vector<cv::Mat>& images) {
-    int key = 0;
-    for (std::vector<cv::Mat>::const_iterator it = images.begin();
-            it < images.end() && key != 's' && key != 'q'; ++it) {
-        key = learn(*it);
-		std::cout << (char)key;
+std::string KNearestOcr::recognizeSamples(const cv::Mat& samples) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    std::string cres(samples.rows, '?');
+    if (samples.rows == 0) {
+        return cres;
     }
-    return key;
-}
-
-/**
- * Save training data to file.
- */
-void KNearestOcr::saveTrainingData() {
-    cv::FileStorage fs(config.getTrainingDataFilename(), cv::FileStorage::WRITE);
-    fs << "samples" << _samples;
-    fs << "responses" << _responses;
-    fs.release();
-}
-
-/**
- * Load training data from file and init model.
- */
-bool KNearestOcr::loadTrainingData() {
-    cv::FileStorage fs(config.getTrainingDataFilename(), cv::FileStorage::READ);
-    if (fs.isOpened()) {
-        fs["samples"] >> _samples;
-        fs["responses"] >> _responses;
-        fs.release();
-
-        initModel();
-    } else {
-        return false;
+    try {
+        cv::Mat results, neighborResponses, dists;
+        findNearest(samples, results, neighborResponses, dists);
+        for (int i = 0; i < samples.rows; ++i) {
+            float result = results.at<float>(i, 0);
+            const float* responses = neighborResponses.ptr<float>(i);
+            const float* dist = dists.ptr<float>(i);
+            if (0 == int(responses[0] - responses[1]) && dist[0] < _config.getOcrMaxDist()) {
+                // valid character if both neighbors have the same value and distance is below ocrMaxDist
+                cres[i] = '0' + (int) result;
+            } else if (rlog.isInfoEnabled()) {
+                rlog << log4cpp::Priority::INFO << "OCR rejected: " << (int) result;
+            }
+            if (rlog.isDebugEnabled()) {
+                rlog << log4cpp::Priority::DEBUG << "result: " << result << " neighborResponses: " << responses[0]
+                        << ", " << responses[1] << " dists: " << dist[0] << ", " << dist[1];
+            }
+        }
+    } catch (std::exception & e) {
+        rlog << log4cpp::Priority::ERROR << e.what();
     }
-    return true;
+    return cres;
 }
 
 /**
- * Recognize a single digit.
+ * Find the two nearest neighbours of all rows of samples with the configured engine.
+ * results gets the response CvKNearest votes for: the common response of both
+ * neighbours, the smaller one if they differ.
  */
-char KNearestOcr::recognize(const cv::Mat& img) {
-    log4cpp::Category& rlog = log4cpp::Category::getRoot();
-    char cres = '?';
-    try {
+void KNearestOcr::findNearest(const cv::Mat & samples, cv::Mat & results, cv::Mat & neighborResponses,
+        cv::Mat & dists) {
+    if (!_useIndex) {
         if (!_pModel) {
             throw std::runtime_error("Model is not initialized");
         }
-        cv::Mat results, neighborResponses, dists;
-        float result = _pModel->find_nearest(prepareSample(img), 2, results, neighborResponses, dists);
-        if (0 == int(neighborResponses.at<float>(0, 0) - neighborResponses.at<float>(0, 1))
-                && dists.at<float>(0, 0) < config.getOcrMaxDist()) {
-            // valid character if both neighbors have the same value and distance is below ocrMaxDist
-            cres = '0' + (int) result;
-        } else if (rlog.isInfoEnabled()) {
-            rlog << log4cpp::Priority::INFO << "OCR rejected: " << (int) result;
+        _pModel->find_nearest(samples, 2, results, neighborResponses, dists);
+        return;
+    }
+    std::vector<KnnIndex::Neighbors> found;
+    _index.find(samples, found);
+    results.create(samples.rows, 1, CV_32F);
+    neighborResponses.create(samples.rows, 2, CV_32F);
+    dists.create(samples.rows, 2, CV_32F);
+    for (int i = 0; i < samples.rows; ++i) {
+        const KnnIndex::Neighbors & n = found[i];
+        float* responses = neighborResponses.ptr<float>(i);
+        float* dist = dists.ptr<float>(i);
+        if (n.count < 2) {
+            // different responses: always rejected
+            responses[0] = -1.f;
+            responses[1] = -2.f;
+            dist[0] = dist[1] = FLT_MAX;
+        } else {
+            responses[0] = n.responses[0];
+            responses[1] = n.responses[1];
+            dist[0] = n.dists[0];
+            dist[1] = n.dists[1];
         }
-        rlog << log4cpp::Priority::DEBUG << "results: " << results;
-        rlog << log4cpp::Priority::DEBUG << "neighborResponses: " << neighborResponses;
-        rlog << log4cpp::Priority::DEBUG << "dists: " << dists;
-    } catch (std::exception & e) {
-        rlog << log4cpp::Priority::ERROR << e.what();
+        results.at<float>(i, 0) = std::min(responses[0], responses[1]);
     }
-    return cres;
 }
 
 /**
- * Recognize a vector of digits.
+ * Initialize the model with all training data.
  */
-std::string KNearestOcr::recognize(const std::vector<cv::Mat>& images) {
-    std::string result;
-    for (std::vector<cv::Mat>::const_iterator it = images.begin();
-            it != images.end(); ++it) {
-        result += recognize(*it);
+void KNearestOcr::initModel() {
+    delete _pModel;
+    _pModel = 0;
+    _useIndex = false;
+    if (_config.getKnnEngine() == "simd") {
+        if (_samples.empty() && _file.isOpen() && _file.stride() == KnnIndex::STRIDE) {
+            _index.attach(_file.samples(), _file.responses(), _file.rows(), _file.cols());
+            _useIndex = true;
+            return;
+        }
+        loadSamples();
+        if (_index.build(_samples, _responses)) {
+            _useIndex = true;
+            return;
+        }
+        log4cpp::Category::getRoot() << log4cpp::Priority::WARN
+                << "Training data does not fit into 8 bit, using the opencv kNN engine";
     }
-    return result;
+    loadSamples();
+    _pModel = new CvKNearest(_samples, _responses, cv::Mat(), false, MAX_K);
 }
 
 /**
- * Prepare an image of a digit to work as a sample for the model.
+ * Add a learned sample to the model.
+ * CvKNearest keeps its samples in a list of blocks, with updateBase the new
+ * sample is appended as a block instead of copying the whole training data again.
  */
-cv::Mat KNearestOcr::prepareSample(const cv::Mat& img) {
-    cv::Mat roi, sample;
-    cv::resize(img, roi, cv::Size(10, 10));
-    roi.reshape(1, 1).convertTo(sample, CV_32F);
-    return sample;
+void KNearestOcr::addToModel(const cv::Mat & sample, const cv::Mat & response) {
+    if (_useIndex) {
+        if (!_index.add(sample, response.at<float>(0, 0))) {
+            initModel();
+        }
+    } else if (!_pModel || _pModel->get_sample_count() == 0) {
+        initModel();
+    } else {
+        _pModel->train(sample, response, cv::Mat(), false, MAX_K, true);
+    }
 }
 
 /**
- * Initialize the model.
+ * Forget the model, e.g. before the mapped training data is closed.
  */
-void KNearestOcr::initModel() {
-    _pModel = new CvKNearest(_samples, _responses);
+void KNearestOcr::resetModel() {
+    delete _pModel;
+    _pModel = 0;
+    _useIndex = false;
+    _index.build(cv::Mat(), cv::Mat());
 }
-
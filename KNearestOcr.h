@@ -6,33 +6,38 @@
 #ifndef KNEARESTOCR_H_
 #define KNEARESTOCR_H_
 
-#include <vector>
-#include <list>
 #include <string>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/ml/ml.hpp>
 
-class KNearestOcr {
+#include "Config.h"
+#include "Ocr.h"
+#include "KnnIndex.h"
+
+/**
+ * OCR engine with the k nearest neighbours of the training samples.
+ * Its cost grows with the number of samples.
+ */
+class KNearestOcr : public Ocr {
 public:
-    KNearestOcr();
+    KNearestOcr(const Config & config = ::config);
     virtual ~KNearestOcr();
 
-    int learn(const cv::Mat & img);
-    int learn(const std::vector<cv::Mat> & images);
-    void saveTrainingData();
-    bool loadTrainingData();
+    virtual std::string recognizeSamples(const cv::Mat & samples);
 
-    char recognize(const cv::Mat & img);
-    std::string recognize(const std::vector<cv::Mat> & images);
+protected:
+    virtual void initModel();
+    virtual void addToModel(const cv::Mat & sample, const cv::Mat & response);
+    virtual void resetModel();
 
-    cv::Mat _samples;
-    cv::Mat _responses;
+private:
+    void findNearest(const cv::Mat & samples, cv::Mat & results, cv::Mat & neighborResponses, cv::Mat & dists);
 
-	private:
-    cv::Mat prepareSample(const cv::Mat & img);
-    void initModel();
+    static const int MAX_K = 32;
 
     CvKNearest* _pModel;
+    KnnIndex _index;
+    bool _useIndex;
 };
 
 #endif /* KNEARESTOCR_H_ */
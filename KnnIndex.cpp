@@ -0,0 +1,267 @@
+/*
+ * KnnIndex.cpp
+ *
+ */
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "KnnIndex.h"
+
+/**
+ * Number of bytes after which the partial distance is checked.
+ */
+static const int CHUNK = 32;
+
+#if defined(__AVX2__)
+
+/**
+ * Squared distance of CHUNK bytes.
+ */
+static inline int chunkDistance(const unsigned char* a, const unsigned char* b) {
+    __m256i a0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) a));
+    __m256i b0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) b));
+    __m256i a1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (a + 16)));
+    __m256i b1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (b + 16)));
+    __m256i d0 = _mm256_sub_epi16(a0, b0);
+    __m256i d1 = _mm256_sub_epi16(a1, b1);
+    __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(d0, d0), _mm256_madd_epi16(d1, d1));
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(s);
+}
+
+const char* KnnIndex::kernelName() {
+    return "avx2";
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+static inline int chunkDistance(const unsigned char* a, const unsigned char* b) {
+    uint32x4_t sum = vdupq_n_u32(0);
+    for (int i = 0; i < CHUNK; i += 16) {
+        uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+        // 255 * 255 fits into 16 bit
+        sum = vpadalq_u16(sum, vmull_u8(vget_low_u8(d), vget_low_u8(d)));
+        sum = vpadalq_u16(sum, vmull_u8(vget_high_u8(d), vget_high_u8(d)));
+    }
+    uint64x2_t pairs = vpaddlq_u32(sum);
+    return (int) (vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1));
+}
+
+const char* KnnIndex::kernelName() {
+    return "neon";
+}
+
+#else
+
+static inline int chunkDistance(const unsigned char* a, const unsigned char* b) {
+    int sum = 0;
+    for (int i = 0; i < CHUNK; ++i) {
+        int d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+const char* KnnIndex::kernelName() {
+    return "scalar";
+}
+
+#endif
+
+KnnIndex::KnnIndex() :
+        _rows(0), _labels(0), _count(0), _attached(false), _dims(0) {
+}
+
+/**
+ * Take over the training data (one float sample per row).
+ * Returns false if the samples are no integral values of 0..255 or have too
+ * many features; the index is empty then.
+ */
+bool KnnIndex::build(const cv::Mat & samples, const cv::Mat & responses) {
+    _data.clear();
+    _responses.clear();
+    _attached = false;
+    useOwned();
+    _dims = samples.cols;
+    if (samples.empty()) {
+        return true;
+    }
+    if (samples.type() != CV_32F || _dims > STRIDE || responses.rows != samples.rows) {
+        return false;
+    }
+    _data.reserve((size_t) samples.rows * STRIDE);
+    _responses.reserve(samples.rows);
+    for (int i = 0; i < samples.rows; ++i) {
+        if (!add(samples.row(i), responses.at<float>(i, 0))) {
+            _data.clear();
+            _responses.clear();
+            useOwned();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Search count rows of STRIDE bytes with dims features and zero padding,
+ * without copying them. The memory must stay valid while it is attached.
+ */
+void KnnIndex::attach(const unsigned char* rows, const float* responses, int count, int dims) {
+    _data.clear();
+    _responses.clear();
+    _rows = rows;
+    _labels = responses;
+    _count = count;
+    _dims = dims;
+    _attached = true;
+}
+
+/**
+ * Append a sample. The storage grows geometrically.
+ */
+bool KnnIndex::add(const cv::Mat & sample, float response) {
+    if (_attached) {
+        _data.assign(_rows, _rows + (size_t) _count * STRIDE);
+        _responses.assign(_labels, _labels + _count);
+        _attached = false;
+    }
+    if (_responses.empty()) {
+        _dims = sample.cols;
+    }
+    size_t offset = _data.size();
+    _data.resize(offset + STRIDE, 0);
+    if (!quantize(sample, &_data[offset])) {
+        _data.resize(offset);
+        useOwned();
+        return false;
+    }
+    _responses.push_back(response);
+    useOwned();
+    return true;
+}
+
+void KnnIndex::useOwned() {
+    _rows = _data.empty() ? 0 : &_data[0];
+    _labels = _responses.empty() ? 0 : &_responses[0];
+    _count = (int) _responses.size();
+}
+
+/**
+ * Convert a float sample into a padded 8 bit row.
+ * Returns false if a value is not an integer of 0..255.
+ */
+bool KnnIndex::quantize(const cv::Mat & sample, unsigned char* row) const {
+    if (sample.type() != CV_32F || sample.rows != 1 || sample.cols != _dims || _dims > STRIDE) {
+        return false;
+    }
+    const float* values = sample.ptr<float>(0);
+    for (int i = 0; i < _dims; ++i) {
+        float v = values[i];
+        if (!(v >= 0.f && v <= 255.f) || v != std::floor(v)) {
+            return false;
+        }
+        row[i] = (unsigned char) v;
+    }
+    memset(row + _dims, 0, STRIDE - _dims);
+    return true;
+}
+
+KnnIndex::Neighbors KnnIndex::find(const cv::Mat & sample) const {
+    std::vector<Neighbors> result;
+    find(sample, result);
+    return result[0];
+}
+
+/**
+ * Find the two nearest samples of every row of samples.
+ * Rows that do not fit into 8 bit get no neighbours.
+ */
+void KnnIndex::find(const cv::Mat & samples, std::vector<Neighbors> & result) const {
+    const int count = samples.rows;
+    result.resize(count);
+    if (count == 0) {
+        return;
+    }
+    std::vector<unsigned char> queries((size_t) count * STRIDE);
+    std::vector<int> valid;
+    valid.reserve(count);
+    for (int q = 0; q < count; ++q) {
+        if (quantize(samples.row(q), &queries[valid.size() * STRIDE])) {
+            valid.push_back(q);
+        } else {
+            result[q].count = 0;
+        }
+    }
+    if (valid.size() == (size_t) count) {
+        find(&queries[0], count, &result[0]);
+    } else if (!valid.empty()) {
+        std::vector<Neighbors> found(valid.size());
+        find(&queries[0], (int) valid.size(), &found[0]);
+        for (size_t v = 0; v < valid.size(); ++v) {
+            result[valid[v]] = found[v];
+        }
+    }
+}
+
+/**
+ * Find the two nearest samples of count padded query rows.
+ * The training rows are the outer loop, so the model is read once per batch
+ * while the queries stay in the cache.
+ */
+void KnnIndex::find(const unsigned char* queries, int count, Neighbors* result) const {
+    std::vector<int> best(2 * count, INT_MAX);
+    std::vector<int> index(2 * count, -1);
+    const int rows = size();
+    const unsigned char* row = _rows;
+    for (int i = 0; i < rows; ++i, row += STRIDE) {
+        const unsigned char* query = queries;
+        for (int q = 0; q < count; ++q, query += STRIDE) {
+            int* b = &best[2 * q];
+            int dist = 0;
+            for (int c = 0; c < STRIDE && dist < b[1]; c += CHUNK) {
+                dist += chunkDistance(row + c, query + c);
+            }
+            if (dist >= b[1]) {
+                // equal distances keep the earlier sample
+                continue;
+            }
+            int* idx = &index[2 * q];
+            if (dist < b[0]) {
+                b[1] = b[0];
+                idx[1] = idx[0];
+                b[0] = dist;
+                idx[0] = i;
+            } else {
+                b[1] = dist;
+                idx[1] = i;
+            }
+        }
+    }
+
+    for (int q = 0; q < count; ++q) {
+        result[q].count = 0;
+        for (int k = 0; k < 2 && index[2 * q + k] >= 0; ++k) {
+            result[q].responses[k] = _labels[index[2 * q + k]];
+            result[q].dists[k] = (float) best[2 * q + k];
+            result[q].count = k + 1;
+        }
+    }
+}
+
+int KnnIndex::size() const {
+    return _count;
+}
+
+int KnnIndex::dims() const {
+    return _dims;
+}
@@ -0,0 +1,64 @@
+/*
+ * KnnIndex.h
+ *
+ */
+
+#ifndef KNNINDEX_H_
+#define KNNINDEX_H_
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * Brute force 2-nearest-neighbour search over digit samples with 8 bit features.
+ * The samples are kept in one contiguous array of rows padded to STRIDE bytes,
+ * the responses in a separate array. Squared distances are computed with
+ * AVX2 or NEON if the compiler targets them, and abort as soon as the partial
+ * distance cannot beat the second best neighbour any more.
+ * Only samples and queries with integral features 0..255 are accepted, so the
+ * 8 bit distances are exact: the result is the exact 2-nearest-neighbour search
+ * over these samples, of equal distances the sample added first wins. This
+ * matches CvKNearest::find_nearest() with k = 2 on the same samples, which
+ * -B knn checks, also with duplicate and equidistant samples.
+ * The samples can also be attached from memory in this layout (e.g. a mapped
+ * TrainingFile); they are copied only when a sample is added.
+ */
+class KnnIndex {
+public:
+    static const int STRIDE = 128;
+
+    struct Neighbors {
+        int count;
+        float responses[2];
+        float dists[2];
+    };
+
+    KnnIndex();
+
+    bool build(const cv::Mat & samples, const cv::Mat & responses);
+    void attach(const unsigned char* rows, const float* responses, int count, int dims);
+    bool add(const cv::Mat & sample, float response);
+    Neighbors find(const cv::Mat & sample) const;
+    void find(const cv::Mat & samples, std::vector<Neighbors> & result) const;
+    void find(const unsigned char* queries, int count, Neighbors* result) const;
+    bool quantize(const cv::Mat & sample, unsigned char* row) const;
+    int size() const;
+    int dims() const;
+
+    static const char* kernelName();
+
+private:
+    void useOwned();
+
+    std::vector<unsigned char> _data;
+    std::vector<float> _responses;
+    // the searched samples: _data or attached memory
+    const unsigned char* _rows;
+    const float* _labels;
+    int _count;
+    bool _attached;
+    int _dims;
+};
+
+#endif /* KNNINDEX_H_ */
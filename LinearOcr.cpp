@@ -0,0 +1,136 @@
+/*
+ * LinearOcr.cpp
+ *
+ * OCR to train and recognize digits with linear one-vs-rest models.
+ *
+ */
+
+#include <algorithm>
+
+#include <log4cpp/Category.hh>
+#include <log4cpp/Priority.hh>
+
+#include "LinearOcr.h"
+
+/**
+ * Weight of the ridge regularization, relative to features of 0..1.
+ */
+static const double RIDGE = 1.;
+
+LinearOcr::LinearOcr(const Config & config) :
+        Ocr(config) {
+}
+
+LinearOcr::~LinearOcr() {
+}
+
+/**
+ * Scale the samples to 0..1 and append a constant 1 for the bias.
+ */
+void LinearOcr::features(const cv::Mat & samples, cv::Mat & x) const {
+    x.create(samples.rows, samples.cols + 1, CV_32F);
+    cv::Mat scaled = x.colRange(0, samples.cols);
+    samples.convertTo(scaled, CV_32F, 1. / 255.);
+    x.col(samples.cols).setTo(cv::Scalar(1.));
+}
+
+/**
+ * Add samples to the normal equations, the targets are 1 for the digit and 0 otherwise.
+ */
+void LinearOcr::accumulate(const cv::Mat & samples, const cv::Mat & responses) {
+    cv::Mat x, x64;
+    features(samples, x);
+    x.convertTo(x64, CV_64F);
+    cv::Mat y = cv::Mat::zeros(samples.rows, CLASSES, CV_64F);
+    for (int i = 0; i < samples.rows; ++i) {
+        int digit = (int) responses.at<float>(i, 0);
+        if (digit >= 0 && digit < CLASSES) {
+            y.at<double>(i, digit) = 1.;
+        }
+    }
+    if (_xtx.empty()) {
+        _xtx = cv::Mat::eye(x.cols, x.cols, CV_64F) * RIDGE;
+        _xty = cv::Mat::zeros(x.cols, CLASSES, CV_64F);
+    }
+    _xtx += x64.t() * x64;
+    _xty += x64.t() * y;
+}
+
+void LinearOcr::solve() {
+    cv::Mat weights;
+    cv::solve(_xtx, _xty, weights, cv::DECOMP_CHOLESKY);
+    weights.convertTo(_weights, CV_32F);
+}
+
+/**
+ * Fit the models to all training data.
+ */
+void LinearOcr::initModel() {
+    resetModel();
+    loadSamples();
+    if (_samples.empty()) {
+        return;
+    }
+    accumulate(_samples, _responses);
+    solve();
+}
+
+/**
+ * Add a learned sample to the normal equations and solve them again.
+ */
+void LinearOcr::addToModel(const cv::Mat & sample, const cv::Mat & response) {
+    accumulate(sample, response);
+    solve();
+}
+
+void LinearOcr::resetModel() {
+    _xtx.release();
+    _xty.release();
+    _weights.release();
+}
+
+/**
+ * Recognize all rows of samples, prepared with prepareSample(), with one
+ * matrix product. Returns one character per row, '?' if it was rejected.
+ */
+std::string LinearOcr::recognizeSamples(const cv::Mat & samples) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    std::string cres(samples.rows, '?');
+    if (samples.rows == 0) {
+        return cres;
+    }
+    if (_weights.empty() || samples.cols + 1 != _weights.rows) {
+        rlog << log4cpp::Priority::ERROR << "Model is not initialized";
+        return cres;
+    }
+    cv::Mat x, scores;
+    features(samples, x);
+    scores = x * _weights;
+    for (int i = 0; i < samples.rows; ++i) {
+        const float* score = scores.ptr<float>(i);
+        int best = 0;
+        int second = 1;
+        if (score[second] > score[best]) {
+            std::swap(best, second);
+        }
+        for (int c = 2; c < CLASSES; ++c) {
+            if (score[c] > score[best]) {
+                second = best;
+                best = c;
+            } else if (score[c] > score[second]) {
+                second = c;
+            }
+        }
+        float margin = score[best] - score[second];
+        if (margin >= _config.getOcrMinMargin()) {
+            cres[i] = '0' + best;
+        } else if (rlog.isInfoEnabled()) {
+            rlog << log4cpp::Priority::INFO << "OCR rejected: " << best;
+        }
+        if (rlog.isDebugEnabled()) {
+            rlog << log4cpp::Priority::DEBUG << "result: " << best << " score: " << score[best] << " margin: "
+                    << margin;
+        }
+    }
+    return cres;
+}
@@ -0,0 +1,47 @@
+/*
+ * LinearOcr.h
+ *
+ */
+
+#ifndef LINEAROCR_H_
+#define LINEAROCR_H_
+
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+#include "Config.h"
+#include "Ocr.h"
+
+/**
+ * OCR engine with one linear model per digit (one-vs-rest), fitted by ridge
+ * regression to the training data. Recognition costs one small matrix
+ * product, independent of the number of samples.
+ * A digit is accepted if its score exceeds the second best by ocrMinMargin.
+ */
+class LinearOcr : public Ocr {
+public:
+    LinearOcr(const Config & config = ::config);
+    virtual ~LinearOcr();
+
+    virtual std::string recognizeSamples(const cv::Mat & samples);
+
+protected:
+    virtual void initModel();
+    virtual void addToModel(const cv::Mat & sample, const cv::Mat & response);
+    virtual void resetModel();
+
+private:
+    void features(const cv::Mat & samples, cv::Mat & x) const;
+    void accumulate(const cv::Mat & samples, const cv::Mat & responses);
+    void solve();
+
+    static const int CLASSES = 10;
+
+    // normal equations X'X + ridge I and X'Y, kept to add learned samples
+    cv::Mat _xtx;
+    cv::Mat _xty;
+    cv::Mat _weights;
+};
+
+#endif /* LINEAROCR_H_ */
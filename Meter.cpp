@@ -0,0 +1,80 @@
+/*
+ * Meter.cpp
+ *
+ */
+
+#include <cstdio>
+
+#include <log4cpp/Category.hh>
+#include <log4cpp/Priority.hh>
+
+#include "Meter.h"
+#include "Stats.h"
+
+/**
+ * A shared OCR must already be loaded, it may be used by several meters at the same time.
+ */
+Meter::Meter(const Config & config, Ocr* sharedOcr) :
+        _config(config), _proc(config), _ownOcr(sharedOcr ? 0 : Ocr::create(config)),
+        _ocr(sharedOcr ? sharedOcr : _ownOcr), _plausi(config), _digitCache(config) {
+    _proc.frameGating();
+}
+
+Meter::~Meter() {
+    _file.close();
+    delete _ownOcr;
+}
+
+/**
+ * Load the training data and open the output file.
+ */
+bool Meter::init() {
+    if (_ownOcr && ! _ownOcr->loadTrainingData()) {
+        log4cpp::Category::getRoot().error("%s: failed to load OCR training data from %s",
+                _config.getName().c_str(), _config.getTrainingDataFilename().c_str());
+        return false;
+    }
+    _file.open(_config.getMeterDataFilename().c_str(), std::ios::out | std::ios::app);
+    return true;
+}
+
+/**
+ * Read the counter from the image and write the value if it is plausible.
+ * The image is not modified.
+ */
+void Meter::process(const cv::Mat & img, time_t time) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    try {
+        _proc.setInput(img);
+        // unchanged counter: keep the last result
+        if (_proc.process()) {
+            StageTimer timer(Stats::OCR);
+            _result = _digitCache.recognize(*_ocr, _proc.getOutput());
+        }
+    } catch (std::exception & e) {
+        rlog << log4cpp::Priority::ERROR << _config.getName() << ": processing failed: " << e.what();
+        _result.clear();
+    }
+
+    rlog << log4cpp::Priority::INFO << _config.getName() << ": " << _result;
+    StageTimer timer(Stats::PLAUSI);
+    if (_plausi.check(_result, time)) {
+        writeValue(_file, _plausi, _config);
+    }
+}
+
+/**
+ * Append the last checked value to the meter data file.
+ */
+void Meter::writeValue(std::ostream & file, Plausi & plausi, const Config & config) {
+    time_t checkedtime = plausi.getCheckedTime();
+    char tlocal[20];
+    strftime(tlocal, 20, "%Y-%m-%d %H:%M:%S", localtime(&checkedtime));
+    char row[200];
+    sprintf(row, "%s;%.*f", tlocal, config.getMeterValueDecimals(), plausi.getCheckedValue());
+    file << row << std::endl;
+}
+
+std::string Meter::getName() const {
+    return _config.getName();
+}
@@ -0,0 +1,52 @@
+/*
+ * Meter.h
+ *
+ */
+
+#ifndef METER_H_
+#define METER_H_
+
+#include <string>
+#include <fstream>
+#include <ctime>
+
+#include <opencv2/core/core.hpp>
+
+#include "Config.h"
+#include "ImageProcessor.h"
+#include "Ocr.h"
+#include "Plausi.h"
+#include "DigitCache.h"
+
+/**
+ * One counter in the image with its own region, digit geometry, training data,
+ * plausibility check and output file.
+ * Several meters may process the same image in parallel, each meter on one
+ * thread at a time.
+ */
+class Meter {
+public:
+    Meter(const Config & config, Ocr* sharedOcr = 0);
+    virtual ~Meter();
+
+    bool init();
+    void process(const cv::Mat & img, time_t time);
+    std::string getName() const;
+
+    static void writeValue(std::ostream & file, Plausi & plausi, const Config & config);
+
+private:
+    Meter(const Meter &);
+    Meter & operator=(const Meter &);
+
+    const Config & _config;
+    HeadlessImageProcessor _proc;
+    Ocr* _ownOcr;
+    Ocr* _ocr;
+    Plausi _plausi;
+    DigitCache _digitCache;
+    std::string _result;
+    std::fstream _file;
+};
+
+#endif /* METER_H_ */
@@ -0,0 +1,305 @@
+/*
+ * MultiSource.cpp
+ *
+ */
+
+#include <algorithm>
+#include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <cstring>
+
+#include <opencv2/core/core.hpp>
+
+#include <log4cpp/Category.hh>
+#include <log4cpp/Priority.hh>
+
+#include "MultiSource.h"
+#include "HttpClient.h"
+#include "Stats.h"
+
+MultiSource::MultiSource(int threads) :
+        _pool(threads) {
+    _wakeFds[0] = _wakeFds[1] = -1;
+    if (pipe(_wakeFds) == 0) {
+        fcntl(_wakeFds[0], F_SETFL, O_NONBLOCK);
+        fcntl(_wakeFds[1], F_SETFL, O_NONBLOCK);
+    }
+}
+
+MultiSource::~MultiSource() {
+    _pool.wait();
+    for (size_t i = 0; i < _sources.size(); ++i) {
+        for (size_t j = 0; j < _sources[i]->meters.size(); ++j) {
+            delete _sources[i]->meters[j];
+        }
+        delete _sources[i]->input;
+        delete _sources[i];
+    }
+    for (std::map<std::string, Ocr*>::iterator it = _models.begin(); it != _models.end(); ++it) {
+        delete it->second;
+    }
+    if (_wakeFds[0] >= 0) {
+        close(_wakeFds[0]);
+        close(_wakeFds[1]);
+    }
+}
+
+/**
+ * Read the sources file, e.g.
+ *   sources:
+ *     - { name: power, url: "http://cam1/snapshot.jpg", config: power.yml, interval: 10000 }
+ *     - { name: gas, camera: 0, config: gas.yml }
+ *     - { name: water, stream: "http://cam2/video.mjpg" }
+ * url: image download, camera: camera number, stream: ip camera stream.
+ * config: config file of the source, the main config if missing.
+ * interval: ms between two images, defaultInterval if missing.
+ */
+bool MultiSource::load(const std::string & filename, int defaultInterval) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        rlog.error("Cannot open sources file %s", filename.c_str());
+        return false;
+    }
+    cv::FileNode sources = fs["sources"];
+    for (cv::FileNodeIterator it = sources.begin(); it != sources.end(); ++it) {
+        cv::FileNode node = *it;
+        Source* source = new Source();
+        _sources.push_back(source);
+        source->input = 0;
+        source->url = 0;
+        source->name = node["name"].empty() ? "source" + std::to_string(_sources.size()) : (std::string) node["name"];
+        source->interval = node["interval"].empty() ? defaultInterval : (int) node["interval"];
+        source->due = 0;
+        source->requestStart = 0;
+        source->frameStart = 0;
+        source->requesting = false;
+        source->busy = false;
+        source->pending = 0;
+
+        std::string configFilename = node["config"].empty() ? "" : (std::string) node["config"];
+        if (configFilename.empty()) {
+            source->config = config;
+        } else if (access(configFilename.c_str(), R_OK) == 0) {
+            source->config.loadConfig(configFilename);
+        } else {
+            rlog.error("%s: cannot read config file %s", source->name.c_str(), configFilename.c_str());
+            return false;
+        }
+
+        if (!node["url"].empty()) {
+            source->url = new URLInput((std::string) node["url"]);
+            source->input = source->url;
+        } else if (!node["stream"].empty()) {
+            CameraInput* camera = new CameraInput((std::string) node["stream"]);
+            camera->captureThread();
+            source->input = camera;
+        } else if (!node["camera"].empty()) {
+            CameraInput* camera = new CameraInput((int) node["camera"]);
+            camera->captureThread();
+            source->input = camera;
+        } else {
+            rlog.error("%s: no url, camera or stream given", source->name.c_str());
+            return false;
+        }
+
+        std::vector<const Config*> meterConfigs;
+        if (source->config.getMeters().empty()) {
+            meterConfigs.push_back(&source->config);
+        } else {
+            for (size_t i = 0; i < source->config.getMeters().size(); ++i) {
+                meterConfigs.push_back(&source->config.getMeters()[i]);
+            }
+        }
+        for (size_t i = 0; i < meterConfigs.size(); ++i) {
+            Ocr* ocr = sharedOcr(*meterConfigs[i]);
+            if (!ocr) {
+                return false;
+            }
+            source->meters.push_back(new Meter(*meterConfigs[i], ocr));
+            source->meters.back()->init();
+        }
+        rlog.info("%s: %d meters, every %d ms", source->name.c_str(), (int) source->meters.size(), source->interval);
+    }
+    fs.release();
+
+    if (_sources.empty()) {
+        rlog.error("No sources in %s", filename.c_str());
+        return false;
+    }
+    rlog.info("%d sources, %d OCR models, %d threads", (int) _sources.size(), (int) _models.size(), _pool.size());
+    return true;
+}
+
+/**
+ * OCR model of the training data, loaded once for all meters that use it.
+ * Returns 0 if the training data cannot be loaded.
+ */
+Ocr* MultiSource::sharedOcr(const Config & config) {
+    std::ostringstream key;
+    key << config.getTrainingDataFilename() << ";" << config.getOcrEngine() << ";" << config.getKnnEngine() << ";"
+            << config.getOcrMaxDist() << ";" << config.getOcrMinMargin();
+    std::map<std::string, Ocr*>::iterator it = _models.find(key.str());
+    if (it != _models.end()) {
+        return it->second;
+    }
+    Ocr* ocr = Ocr::create(config);
+    if (!ocr->loadTrainingData()) {
+        log4cpp::Category::getRoot().error("Failed to load OCR training data from %s",
+                config.getTrainingDataFilename().c_str());
+        delete ocr;
+        return 0;
+    }
+    _models[key.str()] = ocr;
+    return ocr;
+}
+
+/**
+ * Run until quit is set. The loop itself never blocks on a single source.
+ */
+void MultiSource::run(const volatile sig_atomic_t & quit) {
+    std::vector<struct pollfd> fds;
+    std::vector<Source*> polled;
+
+    while (!quit) {
+        long long now = HttpClient::now();
+        long long wait = 1000;
+
+        // start the sources that are due
+        for (size_t i = 0; i < _sources.size(); ++i) {
+            Source* source = _sources[i];
+            if (!source->requesting && !source->busy.load(std::memory_order_acquire) && now >= source->due) {
+                source->due = std::max(source->due + source->interval, now);
+                start(source);
+            }
+        }
+
+        fds.clear();
+        polled.clear();
+        struct pollfd wakeFd;
+        wakeFd.fd = _wakeFds[0];
+        wakeFd.events = POLLIN;
+        wakeFd.revents = 0;
+        fds.push_back(wakeFd);
+        for (size_t i = 0; i < _sources.size(); ++i) {
+            Source* source = _sources[i];
+            if (source->requesting) {
+                HttpClient & http = source->url->getHttpClient();
+                struct pollfd pfd;
+                pfd.fd = http.getFd();
+                pfd.events = http.getPollEvents();
+                pfd.revents = 0;
+                fds.push_back(pfd);
+                polled.push_back(source);
+                wait = std::min(wait, http.getDeadline() - now);
+            } else if (!source->busy.load(std::memory_order_acquire)) {
+                wait = std::min(wait, source->due - now);
+            }
+        }
+
+        int rc = poll(&fds[0], fds.size(), (int) std::max(wait, 0LL));
+        if (rc < 0 && errno != EINTR) {
+            log4cpp::Category::getRoot() << log4cpp::Priority::ERROR << "poll failed: " << strerror(errno);
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(_wakeFds[0], buf, sizeof(buf)) > 0) {
+            }
+        }
+        for (size_t i = 0; i < polled.size(); ++i) {
+            Source* source = polled[i];
+            HttpClient & http = source->url->getHttpClient();
+            if (rc > 0 && fds[i + 1].revents) {
+                http.handleEvents(fds[i + 1].revents);
+            }
+            http.checkTimeout();
+            finishRequest(source);
+        }
+        stats.dumpPeriodically();
+    }
+    _pool.wait();
+}
+
+/**
+ * Start the download of a URL source, or hand a camera source to the pool.
+ */
+void MultiSource::start(Source* source) {
+    if (source->url) {
+        source->requestStart = Stats::now();
+        source->requesting = true;
+        source->url->startRequest();
+        // the request may fail right away, e.g. if the host cannot be resolved
+        finishRequest(source);
+    } else {
+        submitFrame(source);
+    }
+}
+
+/**
+ * Hand the image of a finished download to the pool.
+ * Returns false while the request is still running.
+ */
+bool MultiSource::finishRequest(Source* source) {
+    HttpClient::State state = source->url->getHttpClient().getState();
+    if (state != HttpClient::DONE && state != HttpClient::FAILED) {
+        return false;
+    }
+    source->requesting = false;
+    stats.record(Stats::ACQUIRE, Stats::now() - source->requestStart);
+    submitFrame(source);
+    return true;
+}
+
+/**
+ * Decode the image on the pool, then let all meters of the source process it in parallel.
+ * The source stays busy until the last meter finished, so a source never has
+ * two images in flight and its meters see the images in order.
+ */
+void MultiSource::submitFrame(Source* source) {
+    source->busy.store(true, std::memory_order_release);
+    _pool.submit([this, source](int) {
+        source->frameStart = Stats::now();
+        bool success = false;
+        try {
+            success = source->url ? source->url->decodeResponse()
+                    : source->input->nextImage() && !source->input->isSkipped();
+        } catch (std::exception & e) {
+            log4cpp::Category::getRoot() << log4cpp::Priority::ERROR << source->name << ": " << e.what();
+        }
+        if (!success) {
+            source->busy.store(false, std::memory_order_release);
+            wake();
+            return;
+        }
+        source->pending = (int) source->meters.size();
+        for (size_t i = 0; i < source->meters.size(); ++i) {
+            Meter* meter = source->meters[i];
+            _pool.submit([this, source, meter](int) {
+                meter->process(source->input->getImage(), source->input->getTime());
+                meterDone(source);
+            });
+        }
+    });
+}
+
+void MultiSource::meterDone(Source* source) {
+    if (source->pending.fetch_sub(1) == 1) {
+        stats.record(Stats::FRAME, Stats::now() - source->frameStart);
+        source->busy.store(false, std::memory_order_release);
+        wake();
+    }
+}
+
+/**
+ * Interrupt the poll() of the event loop.
+ */
+void MultiSource::wake() {
+    char c = 1;
+    if (write(_wakeFds[1], &c, 1) < 0) {
+        // pipe full: the loop wakes up anyway
+    }
+}
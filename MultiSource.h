@@ -0,0 +1,69 @@
+/*
+ * MultiSource.h
+ *
+ */
+
+#ifndef MULTISOURCE_H_
+#define MULTISOURCE_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <signal.h>
+
+#include "Config.h"
+#include "ImageInput.h"
+#include "Ocr.h"
+#include "Meter.h"
+#include "ThreadPool.h"
+
+/**
+ * Drives many image sources from one event loop.
+ * Downloads of all URL sources run concurrently on non-blocking sockets in a
+ * single poll() loop, cameras grab on their capture threads. Decoding, image
+ * processing and OCR run on a shared thread pool. Each source has its own
+ * schedule, config and meters; meters with the same training data share one
+ * OCR model.
+ */
+class MultiSource {
+public:
+    MultiSource(int threads = 0);
+    virtual ~MultiSource();
+
+    bool load(const std::string & filename, int defaultInterval);
+    void run(const volatile sig_atomic_t & quit);
+
+private:
+    struct Source {
+        std::string name;
+        Config config;
+        ImageInput* input;
+        URLInput* url;
+        std::vector<Meter*> meters;
+        int interval;
+        long long due;
+        long long requestStart;
+        long long frameStart;
+        bool requesting;
+        std::atomic<bool> busy;
+        std::atomic<int> pending;
+    };
+
+    MultiSource(const MultiSource &);
+    MultiSource & operator=(const MultiSource &);
+
+    Ocr* sharedOcr(const Config & config);
+    void start(Source* source);
+    bool finishRequest(Source* source);
+    void submitFrame(Source* source);
+    void meterDone(Source* source);
+    void wake();
+
+    std::vector<Source*> _sources;
+    std::map<std::string, Ocr*> _models;
+    ThreadPool _pool;
+    int _wakeFds[2];
+};
+
+#endif /* MULTISOURCE_H_ */
@@ -0,0 +1,197 @@
+/*
+ * Ocr.cpp
+ *
+ * Training data handling of the OCR engines.
+ *
+ */
+
+#include <iostream>
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <log4cpp/Category.hh>
+#include <log4cpp/Priority.hh>
+
+#include "Ocr.h"
+#include "KNearestOcr.h"
+#include "LinearOcr.h"
+#include "KnnIndex.h"
+
+Ocr::Ocr(const Config & config) :
+        _config(config), _binary(false) {
+}
+
+Ocr::~Ocr() {
+}
+
+/**
+ * Create the engine selected by ocrEngine: "knn" or "linear".
+ */
+Ocr* Ocr::create(const Config & config) {
+    if (config.getOcrEngine() == "linear") {
+        return new LinearOcr(config);
+    }
+    if (config.getOcrEngine() != "knn") {
+        log4cpp::Category::getRoot().warn("Unknown ocrEngine %s, using knn", config.getOcrEngine().c_str());
+    }
+    return new KNearestOcr(config);
+}
+
+/**
+ * Learn a single digit.
+ */
+int Ocr::learn(const cv::Mat & img) {
+
+	int key = 0;
+	int rec = recognize(img);
+	if (rec != '?') {
+		key = rec;
+	} else {
+        cv::imshow("Learn", img);
+		std::cout << "Enter number:" << std::endl;
+        key = (cv::waitKey(0))%256;
+        if (key >= '0' && key <= '9') {
+            cv::Mat response(1, 1, CV_32F, (float) key - '0');
+            cv::Mat sample = prepareSample(img);
+            loadSamples();
+            _responses.push_back(response);
+            _samples.push_back(sample);
+			addToModel(sample, response); // Add new data to recognize()
+		}
+    }
+
+    return key;
+}
+
+/**
+ * Learn a vector of digits.
+ */
+int Ocr::learn(const std::vector<cv::Mat>& images) {
+    int key = 0;
+    for (std::vector<cv::Mat>::const_iterator it = images.begin();
+            it < images.end() && key != 's' && key != 'q'; ++it) {
+        key = learn(*it);
+		std::cout << (char)key;
+    }
+    return key;
+}
+
+/**
+ * Save training data to file, in the format it was loaded from.
+ */
+void Ocr::saveTrainingData() {
+    saveTrainingData(_config.getTrainingDataFilename(), _binary);
+}
+
+/**
+ * Save training data as binary TrainingFile or with cv::FileStorage.
+ */
+bool Ocr::saveTrainingData(const std::string & filename, bool binary) {
+    loadSamples();
+    if (binary) {
+        return TrainingFile::write(filename, _samples, _responses, KnnIndex::STRIDE);
+    }
+    cv::FileStorage fs(filename, cv::FileStorage::WRITE);
+    if (!fs.isOpened()) {
+        return false;
+    }
+    fs << "samples" << _samples;
+    fs << "responses" << _responses;
+    fs.release();
+    return true;
+}
+
+bool Ocr::loadTrainingData() {
+    return loadTrainingData(_config.getTrainingDataFilename());
+}
+
+/**
+ * Load training data from file and init model.
+ * A binary TrainingFile is mapped; the samples are only copied into
+ * _samples and _responses if the model or loadSamples() needs them.
+ */
+bool Ocr::loadTrainingData(const std::string & filename) {
+    _binary = TrainingFile::isBinary(filename);
+    if (_binary) {
+        _samples.release();
+        _responses.release();
+        // the model may refer to the mapped file
+        resetModel();
+        if (!_file.open(filename)) {
+            return false;
+        }
+        initModel();
+        return true;
+    }
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (fs.isOpened()) {
+        fs["samples"] >> _samples;
+        fs["responses"] >> _responses;
+        fs.release();
+
+        resetModel();
+        _file.close();
+        initModel();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Copy the samples of a mapped training file into _samples and _responses.
+ */
+void Ocr::loadSamples() {
+    if (_samples.empty() && _file.isOpen()) {
+        _file.toMats(_samples, _responses);
+    }
+}
+
+/**
+ * Replace the training data and init model.
+ */
+void Ocr::setTrainingData(const cv::Mat & samples, const cv::Mat & responses) {
+    resetModel();
+    _file.close();
+    _samples = samples;
+    _responses = responses;
+    initModel();
+}
+
+/**
+ * Recognize a single digit.
+ */
+char Ocr::recognize(const cv::Mat& img) {
+    return recognizeSample(prepareSample(img));
+}
+
+/**
+ * Recognize a digit that was already prepared with prepareSample().
+ */
+char Ocr::recognizeSample(const cv::Mat& sample) {
+    return recognizeSamples(sample)[0];
+}
+
+/**
+ * Recognize a vector of digits with one classifier call.
+ */
+std::string Ocr::recognize(const std::vector<cv::Mat>& images) {
+    cv::Mat samples;
+    samples.reserve(images.size());
+    for (std::vector<cv::Mat>::const_iterator it = images.begin();
+            it != images.end(); ++it) {
+        samples.push_back(prepareSample(*it));
+    }
+    return recognizeSamples(samples);
+}
+
+/**
+ * Prepare an image of a digit to work as a sample for the model.
+ */
+cv::Mat Ocr::prepareSample(const cv::Mat& img) {
+    cv::Mat roi, sample;
+    cv::resize(img, roi, cv::Size(10, 10));
+    roi.reshape(1, 1).convertTo(sample, CV_32F);
+    return sample;
+}
@@ -0,0 +1,66 @@
+/*
+ * Ocr.h
+ *
+ */
+
+#ifndef OCR_H_
+#define OCR_H_
+
+#include <vector>
+#include <string>
+
+#include <opencv2/core/core.hpp>
+
+#include "Config.h"
+#include "TrainingFile.h"
+
+/**
+ * OCR engine: learns and recognizes digits from the training data.
+ * The training data (YAML or binary TrainingFile) is handled here, the
+ * engines implement the model on top of it.
+ * Recognition must not modify the engine, an engine may be shared by threads.
+ */
+class Ocr {
+public:
+    Ocr(const Config & config = ::config);
+    virtual ~Ocr();
+
+    static Ocr* create(const Config & config = ::config);
+
+    int learn(const cv::Mat & img);
+    int learn(const std::vector<cv::Mat> & images);
+    void saveTrainingData();
+    bool saveTrainingData(const std::string & filename, bool binary);
+    bool loadTrainingData();
+    bool loadTrainingData(const std::string & filename);
+    void loadSamples();
+    void setTrainingData(const cv::Mat & samples, const cv::Mat & responses);
+
+    char recognize(const cv::Mat & img);
+    std::string recognize(const std::vector<cv::Mat> & images);
+    char recognizeSample(const cv::Mat & sample);
+    virtual std::string recognizeSamples(const cv::Mat & samples) = 0;
+    cv::Mat prepareSample(const cv::Mat & img);
+
+    cv::Mat _samples;
+    cv::Mat _responses;
+
+protected:
+    /** Build the model from _samples and _responses, or the mapped _file if _samples is empty. */
+    virtual void initModel() = 0;
+    /** Add a learned sample, which is already appended to _samples. */
+    virtual void addToModel(const cv::Mat & sample, const cv::Mat & response) = 0;
+    /** Forget the model before _file is closed. */
+    virtual void resetModel() = 0;
+
+    const Config & _config;
+    TrainingFile _file;
+
+private:
+    Ocr(const Ocr &);
+    Ocr & operator=(const Ocr &);
+
+    bool _binary;
+};
+
+#endif /* OCR_H_ */
@@ -16,8 +16,8 @@
 #include "Plausi.h"
 #include "Config.h"
 
-Plausi::Plausi() :
-        _value(-1.), _time(0) {
+Plausi::Plausi(const Config & config) :
+        _config(config), _value(-1.), _time(0) {
 }
 
 bool Plausi::check(const std::string& value, time_t time) {
@@ -26,19 +26,19 @@ bool Plausi::check(const std::string& value, time_t time) {
         rlog.info("Plausi check: %s of %s", value.c_str(), ctime(&time));
     }
 
-    if (!std::regex_match (value,std::regex(config.getMeterValueMask()))) {
+    if (!std::regex_match (value,std::regex(_config.getMeterValueMask()))) {
         rlog.info("Plausi rejected: value (%s) does not match with regex",value.c_str());
         return false;
     }
 
-    double dval = (config.getMeterValueDecimals()>0)?atof(value.substr(0,config.getMeterValueLength()).c_str())/(config.getMeterValueDecimals()*10):atof(value.substr(0,config.getMeterValueLength()).c_str());
+    double dval = (_config.getMeterValueDecimals()>0)?atof(value.substr(0,_config.getMeterValueLength()).c_str())/(_config.getMeterValueDecimals()*10):atof(value.substr(0,_config.getMeterValueLength()).c_str());
     _queue.push_back(std::make_pair(time, dval));
 
-    if (_queue.size() < config.getMeterWindow()) {
+    if (_queue.size() < _config.getMeterWindow()) {
         rlog.info("Plausi rejected: not enough values: %d", _queue.size());
         return false;
     }
-    if (_queue.size() > config.getMeterWindow()) {
+    if (_queue.size() > _config.getMeterWindow()) {
         _queue.pop_front();
     }
 
@@ -55,9 +55,9 @@ bool Plausi::check(const std::string& value, time_t time) {
             return false;
         }
         double power = (it->second - dval) / (it->first - time) * 3600.;
-        if (power > config.getMeterMaxPower()) {
+        if (power > _config.getMeterMaxPower()) {
             // consumption of energy must not be greater than limit
-            rlog.info("Plausi rejected: consumption of energy %.3f must not be greater than limit %.3f", power, config.getMeterMaxPower());
+            rlog.info("Plausi rejected: consumption of energy %.3f must not be greater than limit %.3f", power, _config.getMeterMaxPower());
             return false;
         }
         time = it->first;
@@ -69,15 +69,15 @@ bool Plausi::check(const std::string& value, time_t time) {
     if (rlog.isDebugEnabled()) {
         rlog.debug(queueAsString());
     }
-    time_t candTime = _queue.at(config.getMeterWindow()/2).first;
-    double candValue = _queue.at(config.getMeterWindow()/2).second;
+    time_t candTime = _queue.at(_config.getMeterWindow()/2).first;
+    double candValue = _queue.at(_config.getMeterWindow()/2).second;
     if (candValue < _value) {
         rlog.info("Plausi rejected: value must be >= previous checked value");
         return false;
     }
     double power = (candValue - _value) / (candTime - _time) * 3600.;
-    if (power > config.getMeterMaxPower()) {
-        rlog.info("Plausi rejected: consumption of energy (checked value) %.3f must not be greater than limit %.3f", power, config.getMeterMaxPower());
+    if (power > _config.getMeterMaxPower()) {
+        rlog.info("Plausi rejected: consumption of energy (checked value) %.3f must not be greater than limit %.3f", power, _config.getMeterMaxPower());
         return false;
     }
 
@@ -85,7 +85,7 @@ bool Plausi::check(const std::string& value, time_t time) {
     _time = candTime;
     _value = candValue;
     if (rlog.isInfoEnabled()) {
-        rlog.info("Plausi accepted: %.*f of %s", config.getMeterValueDecimals(), _value, ctime(&_time));
+        rlog.info("Plausi accepted: %.*f of %s", _config.getMeterValueDecimals(), _value, ctime(&_time));
     }
     return true;
 }
@@ -104,7 +104,7 @@ std::string Plausi::queueAsString() {
     str += "[";
     std::deque<std::pair<time_t, double> >::const_iterator it = _queue.begin();
     for (; it != _queue.end(); ++it) {
-        sprintf(buf, "%.*f", config.getMeterValueDecimals(), it->second); // %.2f
+        sprintf(buf, "%.*f", _config.getMeterValueDecimals(), it->second); // %.2f
         str += buf;
         str += ", ";
     }
@@ -11,14 +11,17 @@
 #include <utility>
 #include <ctime>
 
+#include "Config.h"
+
 class Plausi {
 public:
-    Plausi();
+    Plausi(const Config & config = ::config);
     bool check(const std::string & value, time_t time);
     double getCheckedValue();
     time_t getCheckedTime();
 private:
     std::string queueAsString();
+    const Config & _config;
     std::deque<std::pair<time_t, double> > _queue;
     time_t _time;
     double _value;
@@ -0,0 +1,124 @@
+/*
+ * SpscQueue.h
+ *
+ */
+
+#ifndef SPSCQUEUE_H_
+#define SPSCQUEUE_H_
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * Bounded lock-free queue for exactly one producer and one consumer thread.
+ * push() and pop() wait while the queue is full or empty, so a slow stage
+ * throttles the stages in front of it (backpressure).
+ * Waiting spins briefly, then yields and finally blocks on a condition
+ * variable until the other side pops or pushes, so an idle stage does not
+ * use any CPU. The mutex is only taken when a side is blocked.
+ */
+template<typename T>
+class SpscQueue {
+public:
+    SpscQueue(size_t capacity) :
+            _slots(capacity + 1), _head(0), _tail(0), _pushWaiting(false), _popWaiting(false) {
+    }
+
+    bool tryPush(T & item) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        size_t next = increment(tail);
+        if (next == _head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        _slots[tail] = std::move(item);
+        _tail.store(next, std::memory_order_release);
+        wake(_popWaiting, _notEmpty);
+        return true;
+    }
+
+    bool tryPop(T & item) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(_slots[head]);
+        _head.store(increment(head), std::memory_order_release);
+        wake(_pushWaiting, _notFull);
+        return true;
+    }
+
+    void push(T & item) {
+        for (int spins = 0; !tryPush(item); ++spins) {
+            if (spins < SPINS) {
+                backoff(spins);
+            } else {
+                block(_pushWaiting, _notFull, [this]() {
+                    return increment(_tail.load(std::memory_order_relaxed)) != _head.load(std::memory_order_acquire);
+                });
+            }
+        }
+    }
+
+    void pop(T & item) {
+        for (int spins = 0; !tryPop(item); ++spins) {
+            if (spins < SPINS) {
+                backoff(spins);
+            } else {
+                block(_popWaiting, _notEmpty, [this]() {
+                    return _head.load(std::memory_order_relaxed) != _tail.load(std::memory_order_acquire);
+                });
+            }
+        }
+    }
+
+private:
+    static const int SPINS = 128;
+
+    size_t increment(size_t index) const {
+        return index + 1 == _slots.size() ? 0 : index + 1;
+    }
+
+    static void backoff(int spins) {
+        if (spins >= SPINS / 2) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * Wait until ready() holds. The flag is set under the mutex before ready()
+     * is checked, and the other side checks the flag after it moved its index
+     * (both behind a full fence), so either ready() sees the new index or the
+     * other side sees the flag and notifies.
+     */
+    template<typename Ready>
+    void block(std::atomic<bool> & waiting, std::condition_variable & cv, Ready ready) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cv.wait(lock, ready);
+        waiting.store(false, std::memory_order_relaxed);
+    }
+
+    void wake(std::atomic<bool> & waiting, std::condition_variable & cv) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            cv.notify_one();
+        }
+    }
+
+    std::vector<T> _slots;
+    // producer and consumer index on separate cache lines
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+    std::atomic<bool> _pushWaiting;
+    std::atomic<bool> _popWaiting;
+    std::mutex _mutex;
+    std::condition_variable _notFull;
+    std::condition_variable _notEmpty;
+};
+
+#endif /* SPSCQUEUE_H_ */
@@ -0,0 +1,199 @@
+/*
+ * Stats.cpp
+ *
+ * Per-stage latency histograms of the processing pipeline.
+ *
+ */
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <ctime>
+#include <cstdio>
+
+#include <log4cpp/Category.hh>
+#include <log4cpp/Priority.hh>
+
+#include "Stats.h"
+#include "Config.h"
+#include "AllocCounter.h"
+
+Stats stats;
+
+LatencyHistogram::LatencyHistogram() :
+        _count(0), _sum(0), _max(0) {
+    for (int i = 0; i < BUCKETS; ++i) {
+        _counts[i] = 0;
+    }
+}
+
+int LatencyHistogram::bucketIndex(long long value) {
+    if (value < 2 * SUB_BUCKETS) {
+        return value < 0 ? 0 : (int) value;
+    }
+    int msb = 63 - __builtin_clzll((unsigned long long) value);
+    int shift = msb - 4;
+    return SUB_BUCKETS + shift * SUB_BUCKETS + (int) ((value >> shift) - SUB_BUCKETS);
+}
+
+/**
+ * Highest value that falls into the bucket.
+ */
+long long LatencyHistogram::bucketValue(int index) {
+    if (index < 2 * SUB_BUCKETS) {
+        return index;
+    }
+    int shift = (index - SUB_BUCKETS) / SUB_BUCKETS;
+    int sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+    return ((long long) (SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(long long value) {
+    _counts[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(value, std::memory_order_relaxed);
+    long long max = _max.load(std::memory_order_relaxed);
+    while (value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * Value below which p percent of the recorded values are.
+ */
+long long LatencyHistogram::percentile(double p) const {
+    unsigned long long count = getCount();
+    if (count == 0) {
+        return 0;
+    }
+    unsigned long long rank = (unsigned long long) (p / 100. * count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    unsigned long long seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        seen += _counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            long long value = bucketValue(i);
+            return value < getMax() ? value : getMax();
+        }
+    }
+    return getMax();
+}
+
+long long LatencyHistogram::getMax() const {
+    return _max.load(std::memory_order_relaxed);
+}
+
+unsigned long long LatencyHistogram::getCount() const {
+    return _count.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::getMean() const {
+    unsigned long long count = getCount();
+    return count ? (double) _sum.load(std::memory_order_relaxed) / count : 0.;
+}
+
+Stats::Stats() :
+        _frames(0), _skipped(0), _digits(0), _reusedDigits(0), _lastDump(now()) {
+}
+
+/**
+ * Monotonic time in microseconds.
+ */
+long long Stats::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000L;
+}
+
+const char* Stats::stageName(Stage stage) {
+    static const char* names[STAGES] = { "acquire", "gate", "blur", "gray", "edges", "skew", "rotate", "digits", "ocr",
+            "plausi", "frame" };
+    return names[stage];
+}
+
+void Stats::record(Stage stage, long long us) {
+    _histograms[stage].record(us);
+}
+
+/**
+ * Count a frame that passed the frame difference gate, skipped if it was unchanged.
+ */
+void Stats::countFrame(bool skipped) {
+    _frames.fetch_add(1, std::memory_order_relaxed);
+    if (skipped) {
+        _skipped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Count recognized digits and the ones taken from the digit cache.
+ */
+void Stats::countDigits(int digits, int reused) {
+    _digits.fetch_add(digits, std::memory_order_relaxed);
+    _reusedDigits.fetch_add(reused, std::memory_order_relaxed);
+}
+
+/**
+ * Write the percentiles of all stages to the log and to statsFilename if configured.
+ */
+void Stats::dump() {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    std::ostringstream out;
+    char line[200];
+    snprintf(line, sizeof(line), "%-8s %10s %10s %10s %10s %10s %10s\n", "stage", "count", "mean", "p50", "p95",
+            "p99", "max");
+    out << line;
+    for (int i = 0; i < STAGES; ++i) {
+        const LatencyHistogram & h = _histograms[i];
+        if (h.getCount() == 0) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "%-8s %10llu %10.0f %10lld %10lld %10lld %10lld\n", stageName((Stage) i),
+                h.getCount(), h.getMean(), h.percentile(50), h.percentile(95), h.percentile(99), h.getMax());
+        out << line;
+    }
+    unsigned long long frames = _frames.load(std::memory_order_relaxed);
+    if (frames > 0) {
+        unsigned long long skipped = _skipped.load(std::memory_order_relaxed);
+        snprintf(line, sizeof(line), "unchanged frames skipped: %llu of %llu (%.1f%%)\n", skipped, frames,
+                100. * skipped / frames);
+        out << line;
+    }
+    unsigned long long digits = _digits.load(std::memory_order_relaxed);
+    if (digits > 0) {
+        unsigned long long reused = _reusedDigits.load(std::memory_order_relaxed);
+        snprintf(line, sizeof(line), "unchanged digits reused: %llu of %llu (%.1f%%)\n", reused, digits,
+                100. * reused / digits);
+        out << line;
+    }
+    rlog << log4cpp::Priority::INFO << "Stage latency [us]:\n" << out.str();
+    if (!config.getStatsFilename().empty()) {
+        std::ofstream file(config.getStatsFilename().c_str(), std::ios::out | std::ios::trunc);
+        file << out.str();
+    }
+    _lastDump = now();
+}
+
+/**
+ * Dump the statistics if statsInterval seconds passed since the last dump.
+ */
+void Stats::dumpPeriodically() {
+    if (config.getStatsInterval() > 0 && now() - _lastDump >= config.getStatsInterval() * 1000000LL) {
+        dump();
+    }
+}
+
+StageTimer::StageTimer(Stats::Stage stage) :
+        _stage(stage), _start(Stats::now()) {
+#ifdef COUNT_ALLOCS
+    _allocs = AllocCounter::getCount();
+#endif
+}
+
+StageTimer::~StageTimer() {
+    stats.record(_stage, Stats::now() - _start);
+#ifdef COUNT_ALLOCS
+    AllocCounter::countStage(_stage, AllocCounter::getCount() - _allocs);
+#endif
+}
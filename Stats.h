@@ -0,0 +1,89 @@
+/*
+ * Stats.h
+ *
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <string>
+#include <atomic>
+
+/**
+ * Latency histogram with logarithmic buckets.
+ * Values below 32 are counted exactly, above that every power of two is split
+ * into 16 linear sub-buckets, so percentiles are within about 6%.
+ * Recording is lock-free and may happen from several threads.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(long long value);
+    long long percentile(double p) const;
+    long long getMax() const;
+    unsigned long long getCount() const;
+    double getMean() const;
+
+private:
+    static const int SUB_BUCKETS = 16;
+    static const int BUCKETS = SUB_BUCKETS + 59 * SUB_BUCKETS;
+
+    static int bucketIndex(long long value);
+    static long long bucketValue(int index);
+
+    std::atomic<unsigned long long> _counts[BUCKETS];
+    std::atomic<unsigned long long> _count;
+    std::atomic<long long> _sum;
+    std::atomic<long long> _max;
+};
+
+/**
+ * Latency statistics of the processing stages in microseconds.
+ */
+class Stats {
+public:
+    enum Stage {
+        ACQUIRE, GATE, BLUR, GRAY, EDGES, SKEW, ROTATE, DIGITS, OCR, PLAUSI, FRAME, STAGES
+    };
+
+    Stats();
+
+    void record(Stage stage, long long us);
+    void countFrame(bool skipped);
+    void countDigits(int digits, int reused);
+    void dump();
+    void dumpPeriodically();
+
+    static long long now();
+    static const char* stageName(Stage stage);
+
+private:
+    LatencyHistogram _histograms[STAGES];
+    std::atomic<unsigned long long> _frames;
+    std::atomic<unsigned long long> _skipped;
+    std::atomic<unsigned long long> _digits;
+    std::atomic<unsigned long long> _reusedDigits;
+    std::atomic<long long> _lastDump;
+};
+
+/**
+ * Measure the time until the end of the scope.
+ * With COUNT_ALLOCS the heap allocations of the stage are counted as well.
+ */
+class StageTimer {
+public:
+    StageTimer(Stats::Stage stage);
+    ~StageTimer();
+
+private:
+    Stats::Stage _stage;
+    long long _start;
+#ifdef COUNT_ALLOCS
+    unsigned long _allocs;
+#endif
+};
+
+extern Stats stats;
+
+#endif /* STATS_H_ */
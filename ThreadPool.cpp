@@ -0,0 +1,93 @@
+/*
+ * ThreadPool.cpp
+ *
+ */
+
+#include <log4cpp/Category.hh>
+#include <log4cpp/Priority.hh>
+
+#include <exception>
+
+#include "ThreadPool.h"
+
+/**
+ * Start the worker threads. 0 threads means one per CPU core.
+ */
+ThreadPool::ThreadPool(int threads) :
+        _active(0), _stop(false) {
+    if (threads <= 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if (threads <= 0) {
+        threads = 1;
+    }
+    for (int i = 0; i < threads; ++i) {
+        _threads.push_back(std::thread(&ThreadPool::run, this, i));
+    }
+}
+
+/**
+ * Finish all queued tasks and stop the workers.
+ */
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _taskAvailable.notify_all();
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        _threads[i].join();
+    }
+}
+
+void ThreadPool::submit(const Task & task) {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _tasks.push_back(task);
+    }
+    _taskAvailable.notify_one();
+}
+
+/**
+ * Block until all submitted tasks are finished.
+ */
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_tasks.empty() || _active > 0) {
+        _idle.wait(lock);
+    }
+}
+
+int ThreadPool::size() const {
+    return (int) _threads.size();
+}
+
+void ThreadPool::run(int worker) {
+    for (;;) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (_tasks.empty() && !_stop) {
+                _taskAvailable.wait(lock);
+            }
+            if (_tasks.empty()) {
+                return;
+            }
+            task = _tasks.front();
+            _tasks.pop_front();
+            ++_active;
+        }
+        try {
+            task(worker);
+        } catch (std::exception & e) {
+            log4cpp::Category::getRoot() << log4cpp::Priority::ERROR << "Task failed: " << e.what();
+        }
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            --_active;
+            if (_tasks.empty() && _active == 0) {
+                _idle.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ * ThreadPool.h
+ *
+ */
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/**
+ * Fixed size pool of worker threads.
+ * Tasks get the index of the executing worker, so that callers can keep
+ * per-worker state (image processor, OCR model) without locking.
+ */
+class ThreadPool {
+public:
+    typedef std::function<void(int)> Task;
+
+    ThreadPool(int threads = 0);
+    virtual ~ThreadPool();
+
+    void submit(const Task & task);
+    void wait();
+    int size() const;
+
+private:
+    void run(int worker);
+
+    std::vector<std::thread> _threads;
+    std::deque<Task> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _taskAvailable;
+    std::condition_variable _idle;
+    int _active;
+    bool _stop;
+};
+
+#endif /* THREADPOOL_H_ */
@@ -0,0 +1,189 @@
+/*
+ * TrainingFile.cpp
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <log4cpp/Category.hh>
+#include <log4cpp/Priority.hh>
+
+#include "TrainingFile.h"
+
+static const char MAGIC[8] = { 'O', 'C', 'M', 'T', 'R', 'A', 'I', 'N' };
+
+TrainingFile::TrainingFile() :
+        _map(0), _size(0), _header(0) {
+}
+
+TrainingFile::~TrainingFile() {
+    close();
+}
+
+/**
+ * Check the magic at the start of the file.
+ */
+bool TrainingFile::isBinary(const std::string & filename) {
+    char magic[sizeof(MAGIC)];
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+    fclose(file);
+    return binary;
+}
+
+/**
+ * Write float samples with values of 0..255 and their responses.
+ * The file is written under a temporary name and renamed, so that processes
+ * that have mapped the old file keep a valid mapping.
+ */
+bool TrainingFile::write(const std::string & filename, const cv::Mat & samples, const cv::Mat & responses,
+        int stride) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    if (samples.type() != CV_32F || responses.rows != samples.rows || samples.cols > stride) {
+        rlog.error("Training data cannot be written as binary file");
+        return false;
+    }
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.rows = samples.rows;
+    header.cols = samples.cols;
+    header.stride = stride;
+    header.samplesOffset = HEADER_SIZE;
+    header.responsesOffset = HEADER_SIZE + samples.rows * stride;
+
+    std::vector<unsigned char> data(header.responsesOffset + samples.rows * sizeof(float), 0);
+    memcpy(&data[0], &header, sizeof(header));
+    for (int i = 0; i < samples.rows; ++i) {
+        const float* values = samples.ptr<float>(i);
+        unsigned char* row = &data[header.samplesOffset + i * stride];
+        for (int c = 0; c < samples.cols; ++c) {
+            float v = values[c];
+            if (!(v >= 0.f && v <= 255.f) || v != std::floor(v)) {
+                rlog << log4cpp::Priority::ERROR << "Sample " << i << " does not fit into 8 bit";
+                return false;
+            }
+            row[c] = (unsigned char) v;
+        }
+        float response = responses.at<float>(i, 0);
+        memcpy(&data[header.responsesOffset + i * sizeof(float)], &response, sizeof(float));
+    }
+
+    std::string tmpname = filename + ".tmp";
+    FILE* file = fopen(tmpname.c_str(), "wb");
+    if (!file) {
+        rlog.error("Cannot write %s", tmpname.c_str());
+        return false;
+    }
+    bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmpname.c_str(), filename.c_str()) != 0) {
+        rlog.error("Cannot write %s", filename.c_str());
+        unlink(tmpname.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Map the file and check its header.
+ */
+bool TrainingFile::open(const std::string & filename) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < HEADER_SIZE) {
+        ::close(fd);
+        return false;
+    }
+    void* map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        rlog.error("Cannot map %s", filename.c_str());
+        return false;
+    }
+    _map = map;
+    _size = st.st_size;
+    _header = (const Header*) _map;
+
+    const Header & h = *_header;
+    if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION) {
+        rlog.error("%s is no training data file of version %u", filename.c_str(), VERSION);
+        close();
+        return false;
+    }
+    if (h.cols > h.stride || h.samplesOffset < HEADER_SIZE
+            || (unsigned long long) h.samplesOffset + (unsigned long long) h.rows * h.stride > h.responsesOffset
+            || h.responsesOffset % sizeof(float) != 0
+            || (unsigned long long) h.responsesOffset + (unsigned long long) h.rows * sizeof(float) > _size) {
+        rlog.error("%s is truncated or corrupt", filename.c_str());
+        close();
+        return false;
+    }
+    return true;
+}
+
+void TrainingFile::close() {
+    if (_map) {
+        munmap(_map, _size);
+    }
+    _map = 0;
+    _size = 0;
+    _header = 0;
+}
+
+bool TrainingFile::isOpen() const {
+    return _header != 0;
+}
+
+/**
+ * Copy the training data into float matrices as cv::FileStorage reads them.
+ */
+void TrainingFile::toMats(cv::Mat & samples, cv::Mat & responses) const {
+    samples.create(rows(), cols(), CV_32F);
+    responses.create(rows(), 1, CV_32F);
+    for (int i = 0; i < rows(); ++i) {
+        const unsigned char* row = this->samples() + i * stride();
+        float* values = samples.ptr<float>(i);
+        for (int c = 0; c < cols(); ++c) {
+            values[c] = row[c];
+        }
+        responses.at<float>(i, 0) = this->responses()[i];
+    }
+}
+
+int TrainingFile::rows() const {
+    return _header ? (int) _header->rows : 0;
+}
+
+int TrainingFile::cols() const {
+    return _header ? (int) _header->cols : 0;
+}
+
+int TrainingFile::stride() const {
+    return _header ? (int) _header->stride : 0;
+}
+
+const unsigned char* TrainingFile::samples() const {
+    return _header ? (const unsigned char*) _map + _header->samplesOffset : 0;
+}
+
+const float* TrainingFile::responses() const {
+    return _header ? (const float*) ((const unsigned char*) _map + _header->responsesOffset) : 0;
+}
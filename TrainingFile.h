@@ -0,0 +1,65 @@
+/*
+ * TrainingFile.h
+ *
+ */
+
+#ifndef TRAININGFILE_H_
+#define TRAININGFILE_H_
+
+#include <string>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+/**
+ * Binary training data, mapped read-only into memory.
+ * Layout (host byte order):
+ *   header of HEADER_SIZE bytes: magic "OCMTRAIN", version, rows, cols, stride,
+ *       offset of the samples, offset of the responses
+ *   rows samples of stride bytes: cols 8 bit features, padded with zeros
+ *   rows float responses
+ * With a stride of KnnIndex::STRIDE the kNN engine searches the mapped samples directly.
+ */
+class TrainingFile {
+public:
+    static const uint32_t VERSION = 1;
+    static const int HEADER_SIZE = 64;
+
+    TrainingFile();
+    ~TrainingFile();
+
+    static bool isBinary(const std::string & filename);
+    static bool write(const std::string & filename, const cv::Mat & samples, const cv::Mat & responses,
+            int stride);
+
+    bool open(const std::string & filename);
+    void close();
+    bool isOpen() const;
+    void toMats(cv::Mat & samples, cv::Mat & responses) const;
+
+    int rows() const;
+    int cols() const;
+    int stride() const;
+    const unsigned char* samples() const;
+    const float* responses() const;
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t rows;
+        uint32_t cols;
+        uint32_t stride;
+        uint32_t samplesOffset;
+        uint32_t responsesOffset;
+    };
+
+    TrainingFile(const TrainingFile &);
+    TrainingFile & operator=(const TrainingFile &);
+
+    void* _map;
+    size_t _size;
+    const Header* _header;
+};
+
+#endif /* TRAININGFILE_H_ */
@@ -0,0 +1,238 @@
+/*
+ * TrainingReducer.cpp
+ *
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cfloat>
+#include <map>
+
+#include <log4cpp/Category.hh>
+#include <log4cpp/Priority.hh>
+
+#include "TrainingReducer.h"
+#include "KNearestOcr.h"
+#include "KnnIndex.h"
+
+TrainingReducer::TrainingReducer(const Config & config) :
+        _config(config) {
+}
+
+/**
+ * Measure the accuracy before and after the reduction on the held out samples,
+ * then reduce all samples into reducedSamples and reducedResponses.
+ * Returns false if the samples are no 8 bit values.
+ */
+bool TrainingReducer::run(const cv::Mat & samples, const cv::Mat & responses, cv::Mat & reducedSamples,
+        cv::Mat & reducedResponses) {
+    KnnIndex check;
+    if (samples.empty() || !check.build(samples, responses)) {
+        report("*** The training data is empty or does not fit into 8 bit");
+        return false;
+    }
+
+    std::vector<int> trainRows, testRows;
+    for (int i = 0; i < samples.rows; ++i) {
+        (i % HOLDOUT == HOLDOUT - 1 ? testRows : trainRows).push_back(i);
+    }
+    cv::Mat trainSamples, trainResponses, testSamples, testResponses;
+    select(samples, responses, trainRows, trainSamples, trainResponses);
+    select(samples, responses, testRows, testSamples, testResponses);
+
+    char line[200];
+    snprintf(line, sizeof(line), "held out: %d of %d samples", testSamples.rows, samples.rows);
+    report(line);
+    snprintf(line, sizeof(line), "%-8s %8s %8s %8s %8s %10s", "model", "samples", "correct", "rejected", "wrong",
+            "accuracy");
+    report(line);
+    reportAccuracy("before", trainSamples.rows, evaluate(trainSamples, trainResponses, testSamples, testResponses));
+    std::vector<int> rows(trainRows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        rows[i] = (int) i;
+    }
+    reduce(trainSamples, trainResponses, rows);
+    cv::Mat condensedSamples, condensedResponses;
+    select(trainSamples, trainResponses, rows, condensedSamples, condensedResponses);
+    reportAccuracy("after", condensedSamples.rows,
+            evaluate(condensedSamples, condensedResponses, testSamples, testResponses));
+
+    rows.resize(samples.rows);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        rows[i] = (int) i;
+    }
+    reduce(samples, responses, rows);
+    select(samples, responses, rows, reducedSamples, reducedResponses);
+    snprintf(line, sizeof(line), "all samples reduced from %d to %d", samples.rows, reducedSamples.rows);
+    report(line);
+    return true;
+}
+
+void TrainingReducer::reduce(const cv::Mat & samples, const cv::Mat & responses, std::vector<int> & rows) {
+    char line[200];
+    size_t count = rows.size();
+    removeDuplicates(samples, responses, rows);
+    snprintf(line, sizeof(line), "  duplicates removed: %d", (int) (count - rows.size()));
+    report(line);
+    count = rows.size();
+    edit(samples, responses, rows);
+    snprintf(line, sizeof(line), "  outvoted samples removed: %d", (int) (count - rows.size()));
+    report(line);
+    count = rows.size();
+    condense(samples, responses, rows);
+    snprintf(line, sizeof(line), "  absorbed samples removed: %d", (int) (count - rows.size()));
+    report(line);
+}
+
+/**
+ * Keep the first of the samples with the same response that are not more
+ * than dedupMaxDist apart.
+ */
+void TrainingReducer::removeDuplicates(const cv::Mat & samples, const cv::Mat & responses,
+        std::vector<int> & rows) {
+    std::map<float, KnnIndex> kept;
+    std::vector<int> result;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        float response = responses.at<float>(rows[i], 0);
+        KnnIndex & index = kept[response];
+        KnnIndex::Neighbors n = index.find(samples.row(rows[i]));
+        if (n.count > 0 && n.dists[0] <= _config.getDedupMaxDist()) {
+            continue;
+        }
+        index.add(samples.row(rows[i]), response);
+        result.push_back(rows[i]);
+    }
+    rows.swap(result);
+}
+
+/**
+ * Wilson editing: remove the samples whose 3 nearest other samples have a
+ * majority for a different response. These are mislabeled or ambiguous digits.
+ */
+void TrainingReducer::edit(const cv::Mat & samples, const cv::Mat & responses, std::vector<int> & rows) {
+    static const int K = 3;
+    std::vector<int> result;
+    for (size_t a = 0; a < rows.size(); ++a) {
+        const float* sa = samples.ptr<float>(rows[a]);
+        float dists[K];
+        float labels[K];
+        int found = 0;
+        for (size_t b = 0; b < rows.size(); ++b) {
+            if (b == a) {
+                continue;
+            }
+            const float* sb = samples.ptr<float>(rows[b]);
+            float dist = 0.f;
+            for (int c = 0; c < samples.cols; ++c) {
+                float d = sa[c] - sb[c];
+                dist += d * d;
+            }
+            if (found == K && dist >= dists[K - 1]) {
+                continue;
+            }
+            int k = found < K ? found++ : K - 1;
+            for (; k > 0 && dists[k - 1] > dist; --k) {
+                dists[k] = dists[k - 1];
+                labels[k] = labels[k - 1];
+            }
+            dists[k] = dist;
+            labels[k] = responses.at<float>(rows[b], 0);
+        }
+        float response = responses.at<float>(rows[a], 0);
+        bool outvoted = false;
+        for (int k = 0; k < found; ++k) {
+            int votes = 0;
+            for (int j = 0; j < found; ++j) {
+                votes += labels[j] == labels[k];
+            }
+            if (labels[k] != response && 2 * votes > found) {
+                outvoted = true;
+            }
+        }
+        if (!outvoted) {
+            result.push_back(rows[a]);
+        }
+    }
+    rows.swap(result);
+}
+
+/**
+ * Hart condensation: a sample is taken into the condensed set if the set does
+ * not yet recognize it with the accept rule of KNearestOcr (two neighbours
+ * with its response, nearest closer than ocrMaxDist). Repeated until all
+ * remaining samples are recognized.
+ */
+void TrainingReducer::condense(const cv::Mat & samples, const cv::Mat & responses, std::vector<int> & rows) {
+    KnnIndex store;
+    std::vector<bool> stored(rows.size(), false);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < rows.size(); ++i) {
+            if (stored[i]) {
+                continue;
+            }
+            float response = responses.at<float>(rows[i], 0);
+            KnnIndex::Neighbors n = store.find(samples.row(rows[i]));
+            if (n.count < 2 || n.responses[0] != response || n.responses[1] != response
+                    || n.dists[0] >= _config.getOcrMaxDist()) {
+                store.add(samples.row(rows[i]), response);
+                stored[i] = true;
+                changed = true;
+            }
+        }
+    }
+    std::vector<int> result;
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (stored[i]) {
+            result.push_back(rows[i]);
+        }
+    }
+    rows.swap(result);
+}
+
+/**
+ * Recognize the test samples with a model of the given samples.
+ */
+TrainingReducer::Accuracy TrainingReducer::evaluate(const cv::Mat & samples, const cv::Mat & responses,
+        const cv::Mat & testSamples, const cv::Mat & testResponses) {
+    KNearestOcr ocr(_config);
+    ocr.setTrainingData(samples, responses);
+    std::string result = ocr.recognizeSamples(testSamples);
+    Accuracy accuracy = { 0, 0, 0 };
+    for (int i = 0; i < testSamples.rows; ++i) {
+        if (result[i] == '?') {
+            ++accuracy.rejected;
+        } else if (result[i] - '0' == (int) testResponses.at<float>(i, 0)) {
+            ++accuracy.correct;
+        } else {
+            ++accuracy.wrong;
+        }
+    }
+    return accuracy;
+}
+
+void TrainingReducer::select(const cv::Mat & samples, const cv::Mat & responses, const std::vector<int> & rows,
+        cv::Mat & selectedSamples, cv::Mat & selectedResponses) {
+    selectedSamples.create((int) rows.size(), samples.cols, samples.type());
+    selectedResponses.create((int) rows.size(), 1, responses.type());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        cv::Mat sample = selectedSamples.row((int) i);
+        cv::Mat response = selectedResponses.row((int) i);
+        samples.row(rows[i]).copyTo(sample);
+        responses.row(rows[i]).copyTo(response);
+    }
+}
+
+void TrainingReducer::report(const std::string & line) {
+    std::cout << line << std::endl;
+    log4cpp::Category::getRoot().info(line);
+}
+
+void TrainingReducer::reportAccuracy(const char* name, int samples, const Accuracy & accuracy) {
+    char line[200];
+    int total = accuracy.correct + accuracy.rejected + accuracy.wrong;
+    snprintf(line, sizeof(line), "%-8s %8d %8d %8d %8d %9.1f%%", name, samples, accuracy.correct, accuracy.rejected,
+            accuracy.wrong, total ? 100. * accuracy.correct / total : 0.);
+    report(line);
+}
@@ -0,0 +1,55 @@
+/*
+ * TrainingReducer.h
+ *
+ */
+
+#ifndef TRAININGREDUCER_H_
+#define TRAININGREDUCER_H_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "Config.h"
+
+/**
+ * Shrinks the OCR training data:
+ * removes duplicates (squared distance up to dedupMaxDist, same response),
+ * edits out samples whose 3 nearest neighbours outvote their response (Wilson),
+ * and condenses the rest to the samples that are needed to recognize all others
+ * with the accept rule of KNearestOcr (Hart).
+ * The accuracy before and after is measured on every 5th sample, held out
+ * of a reduction of the other samples.
+ */
+class TrainingReducer {
+public:
+    TrainingReducer(const Config & config = ::config);
+
+    bool run(const cv::Mat & samples, const cv::Mat & responses, cv::Mat & reducedSamples,
+            cv::Mat & reducedResponses);
+
+private:
+    struct Accuracy {
+        int correct;
+        int rejected;
+        int wrong;
+    };
+
+    void reduce(const cv::Mat & samples, const cv::Mat & responses, std::vector<int> & rows);
+    void removeDuplicates(const cv::Mat & samples, const cv::Mat & responses, std::vector<int> & rows);
+    void edit(const cv::Mat & samples, const cv::Mat & responses, std::vector<int> & rows);
+    void condense(const cv::Mat & samples, const cv::Mat & responses, std::vector<int> & rows);
+    Accuracy evaluate(const cv::Mat & samples, const cv::Mat & responses, const cv::Mat & testSamples,
+            const cv::Mat & testResponses);
+    static void select(const cv::Mat & samples, const cv::Mat & responses, const std::vector<int> & rows,
+            cv::Mat & selectedSamples, cv::Mat & selectedResponses);
+    void report(const std::string & line);
+    void reportAccuracy(const char* name, int samples, const Accuracy & accuracy);
+
+    static const int HOLDOUT = 5;
+
+    const Config & _config;
+};
+
+#endif /* TRAININGREDUCER_H_ */
@@ -6,13 +6,22 @@
 #include <string>
 #include <list>
 #include <algorithm>
+#include <memory>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <string.h>
+#include <signal.h>
 
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -30,16 +39,51 @@
 #include "Config.h"
 #include "Directory.h"
 #include "ImageProcessor.h"
-#include "KNearestOcr.h"
+#include "Ocr.h"
 #include "Plausi.h"
+#include "Meter.h"
+#include "DigitCache.h"
+#include "MultiSource.h"
+#include "Benchmark.h"
+#include "TrainingReducer.h"
+#include "ThreadPool.h"
+#include "Stats.h"
+#include "SpscQueue.h"
 
 static int delay = 1000;
+static volatile sig_atomic_t quit = 0;
+static int threads = 0;
+static bool pipelined = false;
 std::string configFilename;
 
 #ifndef VERSION
 #define VERSION "0.9.6"
 #endif
 
+/**
+ * Get the next image and record the acquisition time.
+ * Frames the input could not fetch (e.g. a network error) are skipped after
+ * the usual delay; false only at the end of the input or after a quit signal.
+ */
+static bool nextImage(ImageInput* pImageInput) {
+    while (!quit) {
+        bool more;
+        {
+            StageTimer timer(Stats::ACQUIRE);
+            more = pImageInput->nextImage();
+        }
+        if (!more) {
+            return false;
+        }
+        if (!pImageInput->isSkipped()) {
+            return true;
+        }
+        usleep(delay*1000L);
+    }
+    return false;
+}
+
+#ifndef HEADLESS
 static void testOcr(ImageInput* pImageInput) {
     
     log4cpp::Category::getRoot().info("testOcr");
@@ -52,19 +96,19 @@ static void testOcr(ImageInput* pImageInput) {
     Plausi plausi;
     char value[10];
 
-    KNearestOcr ocr;
-    if (! ocr.loadTrainingData()) {
+    std::unique_ptr<Ocr> ocr(Ocr::create());
+    if (! ocr->loadTrainingData()) {
         std::cout << "Failed to load OCR training data\n";
         return;
     }
     std::cout << "OCR training data loaded.\n";
     std::cout << "<q> to quit.\n";
 
-    while (pImageInput->nextImage()) {
+    while (nextImage(pImageInput)) {
         proc.setInput(pImageInput->getImage());
         proc.process();
 
-        std::string result = ocr.recognize(proc.getOutput());
+        std::string result = ocr->recognize(proc.getOutput());
         std::cout << result;
         if (plausi.check(result, pImageInput->getTime())) {
             sprintf(value, "%.*f", config.getMeterValueDecimals(), plausi.getCheckedValue());
@@ -87,30 +131,30 @@ static void learnOcr(ImageInput* pImageInput) {
     ImageProcessor proc;
     proc.debugWindow();
 
-    KNearestOcr ocr;
-    ocr.loadTrainingData();
+    std::unique_ptr<Ocr> ocr(Ocr::create());
+    ocr->loadTrainingData();
     std::cout << "Entering OCR training mode!\n";
     std::cout << "<0>..<9> to answer digit, <space> to ignore digit, <s> to save and quit, <q> to quit without saving.\n";
 
     int key = 0;
-    while (pImageInput->nextImage()) {
+    while (nextImage(pImageInput)) {
         proc.setInput(pImageInput->getImage());
         proc.process();
 
-        key = ocr.learn(proc.getOutput());
+        key = ocr->learn(proc.getOutput());
         std::cout << std::endl;
 
         if (key == 'q' || key == 's') {
             std::cout << "Quit\n";
             break;
         }else{
-			ocr.saveTrainingData();
+			ocr->saveTrainingData();
 		}
     }
 
     if (key != 'q') {
         std::cout << "Saving training data\n";
-        ocr.saveTrainingData();
+        ocr->saveTrainingData();
     }
 }
 
@@ -120,20 +164,21 @@ static void checkLearnedOcr() {
     ImageProcessor proc;
     proc.debugWindow();
 
-    KNearestOcr ocr;
-    ocr.loadTrainingData();
+    std::unique_ptr<Ocr> ocr(Ocr::create());
+    ocr->loadTrainingData();
+    ocr->loadSamples();
     std::cout << "Entering learned OCR checking mode!\n";
     std::cout << "<0>..<9> to answer digit if it is not correck, <space> to ignore digit, <d> to delete digit, <s> to save and quit, <q> to quit without saving.\n";
 
     int key = 0;
 	cv::Mat rst,dst;
 	cv::Mat big(100,100,CV_32F);
-	for(int i = 0; i < ocr._samples.rows; ++i) {
+	for(int i = 0; i < ocr->_samples.rows; ++i) {
         // Sorban megjelenítjük az eltárolt képeket és kiírjuk a számjegyet
 	    //
 		// image tartalmazza a képet
 		//cv::resize(ocr._samples.row(i).reshape(1,10), rst, cv::Size(100, 100), cv::INTER_NEAREST);
-        rst = ocr._samples.row(i).reshape(1,10);
+        rst = ocr->_samples.row(i).reshape(1,10);
 		for(int j=0;j<10;j++){
 			for(int k=0;k<10;k++){
 				for(int l=0;l<10;l++){
@@ -147,11 +192,11 @@ static void checkLearnedOcr() {
         copyMakeBorder( big, dst, 10, 10, 10, 10, cv::BORDER_CONSTANT, cv::Scalar(0,0,0));
 		cv::imshow("ImageProcessor", dst);
 		//std::cout << ocr._responses.at<float>(i,0) /*ocr._responses.row(i).col(0)*/ << std::endl;
-	    std::cout << "Enter number(" << ocr._responses.at<float>(i,0) << "):" << std::endl;
+	    std::cout << "Enter number(" << ocr->_responses.at<float>(i,0) << "):" << std::endl;
         key = (cv::waitKey(0))%256;
         if (key >= '0' && key <= '9') {
 			// Felülírjuk a kódot
-			ocr._responses.at<float>(i,0) = (float) key - '0';
+			ocr->_responses.at<float>(i,0) = (float) key - '0';
 		}
         if (key == 'q' || key == 's') {
             std::cout << "Quit\n";
@@ -161,7 +206,30 @@ static void checkLearnedOcr() {
 
     if (key != 'q') {
         std::cout << "Saving training data\n";
-        ocr.saveTrainingData();
+        ocr->saveTrainingData();
+    }
+}
+
+/**
+ * Mouse handler of the adjust camera window: drag a rectangle in the raw image
+ * to select the region of interest of the counter.
+ */
+static void selectRoi(int event, int x, int y, int flags, void* param) {
+    static cv::Point start;
+    static bool dragging = false;
+    bool rawImage = *(bool*) param;
+
+    if (event == CV_EVENT_LBUTTONDOWN && rawImage) {
+        start = cv::Point(x, y);
+        dragging = true;
+    } else if (event == CV_EVENT_LBUTTONUP && dragging) {
+        dragging = false;
+        cv::Rect roi(cv::Point(std::min(start.x, x), std::min(start.y, y)),
+                cv::Point(std::max(start.x, x), std::max(start.y, y)));
+        if (roi.width > 1 && roi.height > 1) {
+            config.setRoi(roi.x, roi.y, roi.width, roi.height);
+            std::cout << "ROI: " << roi.x << "," << roi.y << " " << roi.width << "x" << roi.height << std::endl;
+        }
     }
 }
 
@@ -176,16 +244,25 @@ static void adjustCamera(ImageInput* pImageInput) {
 
     std::cout << "Adjust camera.\n";
     std::cout << "<r>, <p> to select raw or processed image, <s> to save config and quit, <q> to quit without saving.\n";
+    std::cout << "Drag a rectangle around the counter in the raw image to set the region of interest, <c> to clear it.\n";
 
     bool processImage = true;
+    bool rawImage = false;
+    cv::setMouseCallback("ImageProcessor", selectRoi, &rawImage);
     int key = 0;
-    while (pImageInput->nextImage()) {
+    while (nextImage(pImageInput)) {
         proc.setInput(pImageInput->getImage());
         if (processImage) {
             proc.process();
         } else {
+            if (config.getRoiWidth() > 0 && config.getRoiHeight() > 0) {
+                cv::rectangle(pImageInput->getImage(),
+                        cv::Rect(config.getRoiX(), config.getRoiY(), config.getRoiWidth(), config.getRoiHeight()),
+                        cv::Scalar(0, 0, 255), 2);
+            }
             proc.showImage();
         }
+        rawImage = !processImage;
 
         key = cv::waitKey(delay)%256;
         if (key == 'q' || key == 's') {
@@ -195,6 +272,9 @@ static void adjustCamera(ImageInput* pImageInput) {
             processImage = false;
         } else if (key == 'p') {
             processImage = true;
+        } else if (key == 'c') {
+            config.setRoi(0, 0, 0, 0);
+            std::cout << "ROI cleared" << std::endl;
         }
     }
     if (key != 'q') {
@@ -202,6 +282,7 @@ static void adjustCamera(ImageInput* pImageInput) {
         config.saveConfig();
     }
 }
+#endif /* HEADLESS */
 
 static void capture(ImageInput* pImageInput) {
     log4cpp::Category::getRoot().info("capture");
@@ -209,15 +290,91 @@ static void capture(ImageInput* pImageInput) {
     std::cout << "Capturing images into directory.\n";
     std::cout << "<Ctrl-C> to quit.\n";
 
-    while (pImageInput->nextImage()) {
+    while (nextImage(pImageInput)) {
         usleep(delay*1000L);
     }
 }
 
+/**
+ * Append the last checked value to the meter data file.
+ */
+static void writeValue(std::fstream & emfile, Plausi & plausi) {
+    Meter::writeValue(emfile, plausi, config);
+}
+
+/**
+ * The frames of a recorded image directory (-i) are processed independently
+ * of each other, as backfill() has to: a full skew and digit search in every
+ * frame, no frame gating and no digit cache. So -w, -w -P and -b write the
+ * same data for a directory. Live inputs and -I keep the tracking.
+ */
+static bool independentFrames(ImageInput* pImageInput) {
+    return dynamic_cast<DirectoryInput*>(pImageInput) && !dynamic_cast<DirectoryWatchInput*>(pImageInput);
+}
+
+static void setupProcessor(HeadlessImageProcessor & proc, bool independent) {
+    if (independent) {
+        proc.skewTracking(false);
+        proc.digitTracking(false);
+    } else {
+        proc.frameGating();
+    }
+}
+
+/**
+ * Read all meters configured in the meters section from each image.
+ * The meters process the same decoded image in parallel.
+ */
+static void writeMeters(ImageInput* pImageInput) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    rlog.info("writeMeters");
+
+    const std::vector<Config> & configs = config.getMeters();
+    std::vector<Meter*> meters;
+    for (size_t i = 0; i < configs.size(); ++i) {
+        meters.push_back(new Meter(configs[i]));
+        if (! meters.back()->init()) {
+            std::cout << "Failed to load OCR training data of " << configs[i].getName() << "\n";
+            for (size_t j = 0; j < meters.size(); ++j) {
+                delete meters[j];
+            }
+            return;
+        }
+    }
+    std::cout << "OCR training data of " << meters.size() << " meters loaded.\n";
+    std::cout << "<Ctrl-C> to quit.\n";
+
+    ThreadPool pool(threads > 0 ? std::min(threads, (int) meters.size()) : (int) meters.size());
+    while (!quit && nextImage(pImageInput)) {
+        {
+            StageTimer frameTimer(Stats::FRAME);
+            const cv::Mat & img = pImageInput->getImage();
+            time_t time = pImageInput->getTime();
+            for (size_t i = 0; i < meters.size(); ++i) {
+                Meter* meter = meters[i];
+                pool.submit([meter, &img, time](int) {
+                    meter->process(img, time);
+                });
+            }
+            pool.wait();
+        }
+        stats.dumpPeriodically();
+        usleep(delay*1000L);
+    }
+
+    for (size_t i = 0; i < meters.size(); ++i) {
+        delete meters[i];
+    }
+    stats.dump();
+}
+
 static void writeData(ImageInput* pImageInput) {
-    log4cpp::Category::getRoot().info("writeData");
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    rlog.info("writeData");
 
-    ImageProcessor proc;
+    const bool independent = independentFrames(pImageInput);
+    HeadlessImageProcessor proc;
+    setupProcessor(proc, independent);
 
     //proc.debugWindow(true);
     //proc.debugDigits(true);
@@ -232,8 +389,8 @@ static void writeData(ImageInput* pImageInput) {
 	
     struct stat st;
 
-    KNearestOcr ocr;
-    if (! ocr.loadTrainingData()) {
+    std::unique_ptr<Ocr> ocr(Ocr::create());
+    if (! ocr->loadTrainingData()) {
         std::cout << "Failed to load OCR training data\n";
         return;
     }
@@ -241,26 +398,37 @@ static void writeData(ImageInput* pImageInput) {
     std::cout << "<Ctrl-C> to quit.\n";
 	
 	std::string result = "";
+    DigitCache digitCache;
 
-    while (pImageInput->nextImage()) {
-        proc.setInput(pImageInput->getImage());
-        proc.process();
+    while (!quit && nextImage(pImageInput)) {
         bool recognized = false;
-		//int key = cv::waitKey(1000)%256;
+        {
+            StageTimer frameTimer(Stats::FRAME);
+            try {
+                proc.setInput(pImageInput->getImage());
+                // unchanged counter: keep the last result
+                bool changed = proc.process();
+                //int key = cv::waitKey(1000)%256;
 
-        //if (proc.getOutput().size() == 7) {
-            result = ocr.recognize(proc.getOutput());
+                //if (proc.getOutput().size() == 7) {
+                if (changed) {
+                    StageTimer timer(Stats::OCR);
+                    result = independent ? ocr->recognize(proc.getOutput())
+                            : digitCache.recognize(*ocr, proc.getOutput());
+                }
+            } catch (std::exception & e) {
+                rlog << log4cpp::Priority::ERROR << "Processing failed: " << e.what();
+                result.clear();
+            }
+            StageTimer timer(Stats::PLAUSI);
             if (plausi.check(result, pImageInput->getTime())) {
                 //rrd.update(plausi.getCheckedTime(), plausi.getCheckedValue());
-				time_t checkedtime = plausi.getCheckedTime();
-				char tlocal[20];
-				strftime(tlocal, 20, "%Y-%m-%d %H:%M:%S", localtime(&checkedtime));
-				char row[200];
-				sprintf(row, "%s;%.*f", tlocal, config.getMeterValueDecimals(), plausi.getCheckedValue());
-				emfile << row << std::endl;
-				recognized = true;
+                writeValue(emfile, plausi);
+                recognized = true;
             }
-        //}
+            //}
+        }
+        stats.dumpPeriodically();
         /*
         if (((recognized == false)&& ((previous_result != result)&&(previous_result2 != result)))){ // write debug image when not recognized
             pImageInput->setOutputDir("imgdebug");
@@ -272,26 +440,405 @@ static void writeData(ImageInput* pImageInput) {
         //config.loadConfig();  // load config data periodically
     }
 	emfile.close();
+    stats.dump();
+}
+
+/**
+ * One image on its way through the pipeline.
+ */
+struct PipelineJob {
+    cv::Mat img;
+    time_t time;
+    long long stamp;
+    std::vector<cv::Mat> digits;
+    bool changed;
+    std::string value;
+    bool last;
+};
+
+/**
+ * Pipelined variant of writeData: acquisition, image processing, OCR and
+ * plausibility check / output run on their own threads, connected by bounded
+ * queues. The images pass all stages in order, a full queue stalls the
+ * stages in front of it.
+ */
+static void writeDataPipelined(ImageInput* pImageInput) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    rlog.info("writeDataPipelined");
+
+    const bool independent = independentFrames(pImageInput);
+
+    std::unique_ptr<Ocr> ocr(Ocr::create());
+    if (! ocr->loadTrainingData()) {
+        std::cout << "Failed to load OCR training data\n";
+        return;
+    }
+    std::cout << "OCR training data loaded.\n";
+    std::cout << "<Ctrl-C> to quit.\n";
+
+    const size_t depth = 2;
+    SpscQueue<PipelineJob> acquired(depth);
+    SpscQueue<PipelineJob> processed(depth);
+    SpscQueue<PipelineJob> recognized(depth);
+
+    std::thread acquireThread([&]() {
+        PipelineJob job;
+        job.last = false;
+        while (!quit && nextImage(pImageInput)) {
+            // a fresh buffer per frame: the queues share the pixels of the Mat headers
+            // (cv::Mat has no move), so copyTo into job.img would overwrite queued frames
+            job.img = pImageInput->getImage().clone();
+            job.time = pImageInput->getTime();
+            job.stamp = Stats::now();
+            acquired.push(job);
+            usleep(delay*1000L);
+        }
+        job = PipelineJob();
+        job.last = true;
+        acquired.push(job);
+    });
+
+    std::thread processThread([&]() {
+        HeadlessImageProcessor proc;
+        setupProcessor(proc, independent);
+        PipelineJob job;
+        do {
+            acquired.pop(job);
+            job.digits.clear();
+            job.changed = true;
+            if (!job.last) {
+                try {
+                    proc.setInput(job.img);
+                    job.changed = proc.process();
+                    // the digits point into buffers of the processor
+                    const std::vector<cv::Mat> & digits = proc.getOutput();
+                    for (size_t i = 0; job.changed && i < digits.size(); ++i) {
+                        job.digits.push_back(digits[i].clone());
+                    }
+                } catch (std::exception & e) {
+                    rlog << log4cpp::Priority::ERROR << "Processing failed: " << e.what();
+                }
+                job.img.release();
+            }
+            processed.push(job);
+        } while (!job.last);
+    });
+
+    std::thread ocrThread([&]() {
+        PipelineJob job;
+        std::string lastValue;
+        DigitCache digitCache;
+        do {
+            processed.pop(job);
+            job.value.clear();
+            if (!job.last && job.changed) {
+                StageTimer timer(Stats::OCR);
+                lastValue = independent ? ocr->recognize(job.digits) : digitCache.recognize(*ocr, job.digits);
+            }
+            // unchanged counter: keep the last result
+            job.value = lastValue;
+            recognized.push(job);
+        } while (!job.last);
+    });
+
+    Plausi plausi;
+    std::fstream emfile(config.getMeterDataFilename(), std::ios::out | std::ios::app);
+    PipelineJob job;
+    for (;;) {
+        recognized.pop(job);
+        if (job.last) {
+            break;
+        }
+        {
+            StageTimer timer(Stats::PLAUSI);
+            if (plausi.check(job.value, job.time)) {
+                writeValue(emfile, plausi);
+            }
+        }
+        stats.record(Stats::FRAME, Stats::now() - job.stamp);
+        stats.dumpPeriodically();
+    }
+    emfile.close();
+
+    acquireThread.join();
+    processThread.join();
+    ocrThread.join();
+    stats.dump();
+}
+
+/**
+ * Number of images a backfill task processes before their digits are classified together.
+ */
+static const size_t BACKFILL_BATCH = 8;
+
+/**
+ * Backfill the meter data file from an image directory.
+ * Decoding, image processing and OCR run on a pool of worker threads, while the
+ * results are checked and written strictly in file name order. There is no sleep
+ * between images. The frames are processed independently, like -w does for an
+ * image directory (see independentFrames()), so the output is the same.
+ */
+static void backfill(const std::string & inputDir, int threads) {
+    log4cpp::Category& rlog = log4cpp::Category::getRoot();
+    rlog.info("backfill");
+
+    Directory directory(inputDir.c_str(), ".jpg");
+    std::list<std::string> fileList = directory.list();
+    fileList.sort();
+    std::vector<std::string> files(fileList.begin(), fileList.end());
+
+    ThreadPool pool(threads);
+    std::vector<HeadlessImageProcessor> procs(pool.size());
+    std::vector<std::unique_ptr<Ocr> > ocrs(pool.size());
+    for (int i = 0; i < pool.size(); ++i) {
+        // workers see the frames out of order: search the skew and digits in every frame
+        setupProcessor(procs[i], true);
+        ocrs[i].reset(Ocr::create());
+        if (! ocrs[i]->loadTrainingData()) {
+            std::cout << "Failed to load OCR training data\n";
+            return;
+        }
+    }
+    std::cout << "OCR training data loaded.\n";
+    std::cout << "Processing " << files.size() << " images with " << pool.size() << " threads.\n";
+
+    struct Result {
+        std::string value;
+        bool ready;
+    };
+    std::vector<Result> results(files.size());
+    std::mutex mutex;
+    std::condition_variable resultReady;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t first = 0; first < files.size(); first += BACKFILL_BATCH) {
+        size_t last = std::min(first + BACKFILL_BATCH, files.size());
+        for (size_t i = first; i < last; ++i) {
+            results[i].ready = false;
+        }
+        // the digits of all images of a task are classified in one pass over the model
+        pool.submit([&, first, last](int worker) {
+            cv::Mat samples;
+            std::vector<int> digitCounts(last - first, 0);
+            for (size_t i = first; i < last; ++i) {
+                std::string path = directory.fullpath(files[i]);
+                try {
+                    cv::Mat img;
+                    if (!quit) {
+                        StageTimer timer(Stats::ACQUIRE);
+                        img = cv::imread(path);
+                    }
+                    if (!img.empty()) {
+                        StageTimer frameTimer(Stats::FRAME);
+                        procs[worker].setInput(img);
+                        procs[worker].process();
+                        const std::vector<cv::Mat> & digits = procs[worker].getOutput();
+                        for (size_t d = 0; d < digits.size(); ++d) {
+                            samples.push_back(ocrs[worker]->prepareSample(digits[d]));
+                            ++digitCounts[i - first];
+                        }
+                    }
+                } catch (std::exception & e) {
+                    rlog << log4cpp::Priority::ERROR << "Processing " << path << " failed: " << e.what();
+                }
+            }
+            // every result must become ready, the writer waits for them in order
+            std::vector<std::string> taskValues(last - first);
+            try {
+                std::string values;
+                if (samples.rows > 0) {
+                    StageTimer timer(Stats::OCR);
+                    values = ocrs[worker]->recognizeSamples(samples);
+                }
+                if (values.size() != (size_t) samples.rows) {
+                    rlog.error("OCR returned %d values for %d digits", (int) values.size(), samples.rows);
+                } else {
+                    size_t offset = 0;
+                    for (size_t i = first; i < last; ++i) {
+                        taskValues[i - first] = values.substr(offset, digitCounts[i - first]);
+                        offset += digitCounts[i - first];
+                    }
+                }
+            } catch (std::exception & e) {
+                rlog << log4cpp::Priority::ERROR << "OCR of " << files[first] << " .. " << files[last - 1]
+                        << " failed: " << e.what();
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            for (size_t i = first; i < last; ++i) {
+                results[i].value.swap(taskValues[i - first]);
+                results[i].ready = true;
+            }
+            resultReady.notify_all();
+        });
+    }
+
+    Plausi plausi;
+    std::fstream emfile(config.getMeterDataFilename(), std::ios::out | std::ios::app);
+    size_t processed = 0;
+    for (; processed < files.size() && !quit; ++processed) {
+        size_t i = processed;
+        std::string value;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!results[i].ready) {
+                resultReady.wait(lock);
+            }
+            value.swap(results[i].value);
+        }
+        time_t time = DirectoryInput::parseTime(files[i]);
+        rlog << log4cpp::Priority::INFO << "Processing " << files[i] << " of " << ctime(&time);
+        StageTimer timer(Stats::PLAUSI);
+        if (plausi.check(value, time)) {
+            writeValue(emfile, plausi);
+        }
+    }
+    emfile.close();
+    pool.wait();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double fps = seconds > 0 ? processed / seconds : 0;
+    rlog.info("backfill: %d images in %.1f s, %.1f frames/s", (int) processed, seconds, fps);
+    std::cout << processed << " images in " << seconds << " s, " << fps << " frames/s\n";
+    stats.dump();
+}
+
+/**
+ * Run the image directory through -w, -w -P and -b, each writing to its own
+ * file next to meterDataFilename, and compare the data files.
+ */
+static bool checkBackfill(const std::string & inputDir) {
+    static const char modes[] = { 'w', 'P', 'b' };
+    const int modeCount = sizeof(modes) / sizeof(modes[0]);
+    const std::string meterDataFilename = config.getMeterDataFilename();
+    const int savedDelay = delay;
+    delay = 0;
+
+    std::string outputs[modeCount];
+    for (int m = 0; m < modeCount; ++m) {
+        std::string filename = meterDataFilename + ".check-" + modes[m];
+        unlink(filename.c_str());
+        config.setMeterDataFilename(filename);
+        if (modes[m] == 'b') {
+            backfill(inputDir, threads);
+        } else {
+            DirectoryInput input(Directory(inputDir.c_str(), ".jpg"));
+            if (modes[m] == 'P') {
+                writeDataPipelined(&input);
+            } else {
+                writeData(&input);
+            }
+        }
+        std::ifstream in(filename.c_str());
+        std::ostringstream data;
+        data << in.rdbuf();
+        outputs[m] = data.str();
+        unlink(filename.c_str());
+    }
+    config.setMeterDataFilename(meterDataFilename);
+    delay = savedDelay;
+
+    bool same = true;
+    for (int m = 1; m < modeCount; ++m) {
+        bool ok = outputs[m] == outputs[0];
+        std::cout << "backfill check: -" << modes[m] << " " << (ok ? "ok" : "FAILED") << ", "
+                << std::count(outputs[m].begin(), outputs[m].end(), '\n') << " values, -w "
+                << std::count(outputs[0].begin(), outputs[0].end(), '\n') << " values\n";
+        same = same && ok;
+    }
+    return same;
+}
+
+/**
+ * Convert the training data to filename, see usage() for the format.
+ * With reduce the samples are condensed by TrainingReducer first.
+ */
+static bool convertTrainingData(const std::string & filename, bool reduce) {
+    std::unique_ptr<Ocr> ocr(Ocr::create());
+    if (! ocr->loadTrainingData()) {
+        std::cerr << "*** Failed to load OCR training data " << config.getTrainingDataFilename() << "\n";
+        return false;
+    }
+    if (reduce) {
+        ocr->loadSamples();
+        cv::Mat samples, responses;
+        TrainingReducer reducer;
+        if (! reducer.run(ocr->_samples, ocr->_responses, samples, responses)) {
+            return false;
+        }
+        ocr->setTrainingData(samples, responses);
+    }
+    std::string::size_type dot = filename.rfind('.');
+    std::string extension = dot == std::string::npos ? "" : filename.substr(dot);
+    bool binary = extension != ".yml" && extension != ".yaml" && extension != ".xml";
+    if (! ocr->saveTrainingData(filename, binary)) {
+        std::cerr << "*** Failed to write " << filename << "\n";
+        return false;
+    }
+    std::cout << ocr->_samples.rows << " samples written to " << filename << (binary ? " (binary)\n" : "\n");
+    return true;
+}
+
+/**
+ * SIGINT, SIGTERM: finish the current image and leave the processing loop.
+ * A second signal terminates immediately.
+ */
+static void requestQuit(int) {
+    quit = 1;
+}
+
+static void handleQuitSignals() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestQuit;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, 0);
+    sigaction(SIGTERM, &action, 0);
 }
 
 static void usage(const char* progname) {
     std::cout << "Program to read and recognize the counter of an electricity meter with OpenCV.\n";
     std::cout << "Version: " << VERSION << std::endl;
-    std::cout << "Usage: " << progname << " -c <config file> [-i <dir>|-n <cam>|-p <url>|-u <url>] [-l|-t|-a|-w|-o <dir>] [-s <delay>] [-v <level>\n";
+    std::cout << "Usage: " << progname << " -c <config file> [-i <dir>|-I <dir>|-n <cam>|-p <url>|-u <url>] [-l|-t|-a|-w|-b|-m <sources>|-B <name>|-C <file>|-R <file>|-o <dir>] [-s <delay>] [-j <threads>] [-P] [-v <level>\n";
     std::cout << "  -c <config file name> : config file name (e.g. config.yml).\n";
     std::cout << "\nImage input:\n";
     std::cout << "  -i <image directory> : read image files (png) from directory.\n";
+    std::cout << "  -I <spool directory> : watch directory and read new image files as they arrive.\n";
     std::cout << "  -n <camera number> : read images from camera.\n";
     std::cout << "  -p <ip camera url> : read images from ip camera.\n";
-    std::cout << "  -u <image url> : read images from web.\n";
+    std::cout << "  -u <image url> : read images from web (http://host[:port]/path).\n";
     std::cout << "\nOperation:\n";
+#ifndef HEADLESS
     std::cout << "  -a : adjust camera.\n";
+#endif
     std::cout << "  -o <directory> : capture images into directory.\n";
+#ifndef HEADLESS
     std::cout << "  -l : learn OCR.\n";
     std::cout << "  -t : test OCR.\n";
+#endif
     std::cout << "  -w : write OCR data to file. This is the normal working mode.\n";
+    std::cout << "       With a meters section in the config all meters are read from each image.\n";
+    std::cout << "  -b : backfill OCR data of an image directory (-i) in parallel.\n";
+    std::cout << "  -m <sources file> : write OCR data of many urls and cameras (e.g. sources.yml) from one process.\n";
+    std::cout << "  -B <name> : benchmark on the images of the input (e.g. -i). Names:\n";
+    std::cout << "       skew : speed and accuracy of the skew engines.\n";
+    std::cout << "       alloc : check the heap allocations per frame of the image processing stages\n";
+    std::cout << "               (build with COUNT_ALLOCS=true).\n";
+    std::cout << "       knn : speed of the kNN engines on the digits of the input or the training data.\n";
+    std::cout << "       load : startup time with the YAML and the binary training data format.\n";
+    std::cout << "       ocr : latency and accuracy of the OCR engines on held out training data.\n";
+    std::cout << "       http : check the HTTP client against a local stand-in server.\n";
+    std::cout << "       spool : check that -I moves processed files to spoolDoneDir.\n";
+    std::cout << "       backfill : check that -w, -w -P and -b write the same data for the directory of -i.\n";
+    std::cout << "  -C <file> : convert the training data to file. YAML or XML for the extensions .yml, .yaml\n";
+    std::cout << "       and .xml, the binary mmap-able format otherwise.\n";
+    std::cout << "  -R <file> : remove duplicate, outvoted and redundant samples from the training data and\n";
+    std::cout << "       write the rest to file like -C. Reports the accuracy before and after.\n";
     std::cout << "\nOptions:\n";
     std::cout << "  -s <n> : Sleep n milliseconds after processing of each image (default=1000).\n";
+    std::cout << "  -j <n> : Number of worker threads for -b and -m (default=number of cores).\n";
+    std::cout << "  -P : Run acquisition, image processing, OCR and output of -w on separate threads.\n";
+    std::cout << "       Not with a meters section in the config.\n";
     std::cout << "  -v <l> : Log level. One of DEBUG, INFO, ERROR (default).\n";
 }
 
@@ -315,11 +862,15 @@ int main(int argc, char **argv) {
     ImageInput* pImageInput = 0;
     int inputCount = 0;
     std::string outputDir;
+    std::string inputDir;
+    std::string sourcesFilename;
+    std::string benchmarkName;
+    std::string convertFilename;
     std::string logLevel = "DEBUG";
     char cmd = 0;
     int cmdCount = 0;
     
-    while ((opt = getopt(argc, argv, "c:i:p:n:u:ltawLs:o:v:h")) != -1) {
+    while ((opt = getopt(argc, argv, "c:i:I:p:n:u:ltawbPLm:B:C:R:s:o:j:v:h")) != -1) {
         switch (opt) {
             case 'c':
                 configFilename=optarg;
@@ -327,9 +878,14 @@ int main(int argc, char **argv) {
                 inputCount++;
                 break;
             case 'i':
+                inputDir = optarg;
                 pImageInput = new DirectoryInput(Directory(optarg, ".jpg"));
                 inputCount++;
                 break;
+            case 'I':
+                pImageInput = new DirectoryWatchInput(Directory(optarg, ".jpg"));
+                inputCount++;
+                break;
             case 'n':
                 pImageInput = new CameraInput(atoi(optarg));
                 inputCount++;
@@ -342,11 +898,14 @@ int main(int argc, char **argv) {
                 pImageInput = new URLInput(optarg);
                 inputCount++;
                 break;
+#ifndef HEADLESS
             case 'l':
             case 't':
             case 'a':
-            case 'w':
 			case 'L':
+#endif
+            case 'w':
+            case 'b':
                 cmd = opt;
                 cmdCount++;
                 break;
@@ -355,9 +914,31 @@ int main(int argc, char **argv) {
                 cmdCount++;
                 outputDir = optarg;
                 break;
+            case 'm':
+                cmd = opt;
+                cmdCount++;
+                sourcesFilename = optarg;
+                break;
+            case 'B':
+                cmd = opt;
+                cmdCount++;
+                benchmarkName = optarg;
+                break;
+            case 'C':
+            case 'R':
+                cmd = opt;
+                cmdCount++;
+                convertFilename = optarg;
+                break;
             case 's':
                 delay = atoi(optarg);
                 break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'P':
+                pipelined = true;
+                break;
             case 'v':
                 logLevel = optarg;
                 break;
@@ -388,6 +969,7 @@ int main(int argc, char **argv) {
             pImageInput->setOutputDir(outputDir);
             capture(pImageInput);
             break;
+#ifndef HEADLESS
         case 'l':
             learnOcr(pImageInput);
             break;
@@ -396,13 +978,76 @@ int main(int argc, char **argv) {
             break;
         case 'a':
             adjustCamera(pImageInput);
-            break;
-        case 'w':
-            writeData(pImageInput);
             break;
 		case 'L':
 		    checkLearnedOcr();
 			break;
+#endif
+        case 'w':
+            if (pipelined && !config.getMeters().empty()) {
+                std::cerr << "*** The pipelined mode (-P) does not support a meters section in the config!\n\n";
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            handleQuitSignals();
+            if (!config.getMeters().empty()) {
+                writeMeters(pImageInput);
+            } else if (pipelined) {
+                writeDataPipelined(pImageInput);
+            } else {
+                writeData(pImageInput);
+            }
+            break;
+        case 'b':
+            if (inputDir.empty()) {
+                std::cerr << "*** Backfill needs an image directory (-i)!\n\n";
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            handleQuitSignals();
+            backfill(inputDir, threads);
+            break;
+        case 'B': {
+            if (benchmarkName == "backfill") {
+                if (inputDir.empty()) {
+                    std::cerr << "*** The backfill check needs an image directory (-i)!\n\n";
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                if (! checkBackfill(inputDir)) {
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            }
+            Benchmark benchmark(pImageInput);
+            if (! benchmark.run(benchmarkName)) {
+                std::cerr << "*** Unknown benchmark " << benchmarkName << "\n\n";
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            if (benchmark.getFailed() > 0) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'C':
+        case 'R':
+            if (! convertTrainingData(convertFilename, cmd == 'R')) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm': {
+            MultiSource sources(threads);
+            if (! sources.load(sourcesFilename, delay)) {
+                std::cerr << "*** Failed to load sources from " << sourcesFilename << "\n";
+                exit(EXIT_FAILURE);
+            }
+            std::cout << "<Ctrl-C> to quit.\n";
+            handleQuitSignals();
+            sources.run(quit);
+            stats.dump();
+            break;
+        }
     }
 
     delete pImageInput;